@@ -0,0 +1,535 @@
+#include "artifact.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/file.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+
+#include "sha256.h"
+#include "utils.h"
+
+namespace yamc {
+
+// unfinished entries of writers that died are removed after this long
+static const auto stale_tmp_age = std::chrono::hours(1);
+static const char tmp_prefix[] = ".tmp-";
+// total size of the entries, locked while entries are added or removed
+static const char size_name[] = ".size";
+// "<key> <size>" lines, appended on publishing and on every hit
+static const char journal_name[] = ".journal";
+// the journal is compacted once it grows beyond this
+static const uintmax_t max_journal_size = 1024 * 1024;
+static const char artifact_name[] = "artifact";
+static const char stderr_name[] = "stderr";
+
+/**
+ * @brief hash the size of the file at path, then its content, so that the
+ * bytes of a file can not pass for the names and content of the next one
+ */
+static void hashFile(Sha256 &hash, const fs::path &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        auto err = errno;
+        if (fd != -1) close(fd);
+        throw std::runtime_error("failed to open " + path.string() + ": " +
+                                 strerror(err));
+    }
+    const uint64_t size = st.st_size;
+    hash.update(&size, sizeof(size));
+    static const size_t buf_sz = 64 * 1024;
+    std::vector<char> buf(buf_sz);
+    ssize_t sz;
+    uint64_t total = 0;
+    while ((sz = TEMP_FAILURE_RETRY(read(fd, buf.data(), buf_sz))) > 0) {
+        hash.update(buf.data(), sz);
+        total += sz;
+    }
+    close(fd);
+    if (sz == -1) {
+        throw std::runtime_error("failed to read " + path.string());
+    }
+    if (total != size) {
+        throw std::runtime_error(path.string() + " changed while read");
+    }
+}
+
+static bool isGccDriver(const std::string &name) {
+    static const std::regex driver{
+        R"((.*-)?(gcc|g\+\+|cc|c\+\+|clang|clang\+\+)(-[0-9.]+)?)"};
+    return std::regex_match(fs::path(name).filename().string(), driver);
+}
+
+/**
+ * @brief run args on the host in the C locale and return what it writes to
+ * stdout and stderr, empty if it fails
+ */
+static std::string probe(const std::vector<std::string> &args) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+    auto helper = strvec2cstr(args);
+    const char *env[] = {"LC_ALL=C", "PATH=/usr/local/bin:/usr/bin:/bin",
+                         nullptr};
+    auto pid = fork();
+    if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        throw std::runtime_error(strerror(errno));
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDONLY);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        execve(helper[0], (char *const *)helper.data(), (char *const *)env);
+        _exit(EXIT_FAILURE);
+    }
+    close(fds[1]);
+    std::string out;
+    try {
+        out = readAllFromFd(fds[0]);
+    } catch (const std::exception &e) {
+        out.clear();
+    }
+    close(fds[0]);
+    int status;
+    if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) == -1 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return "";
+    }
+    return out;
+}
+
+/** what a gcc or clang driver is made of besides its own binary */
+struct Toolchain {
+    std::string version;               // output of -v
+    std::vector<fs::path> programs;    // cc1plus and the like
+    std::vector<fs::path> header_dirs;  // the #include <...> search list
+};
+
+static Toolchain probeToolchain(const fs::path &driver) {
+    Toolchain toolchain;
+    toolchain.version = probe({driver, "-v"});
+    for (auto name : {"cc1", "cc1plus", "as", "collect2", "ld"}) {
+        auto out = probe({driver, std::string("-print-prog-name=") + name});
+        out.erase(out.find_last_not_of("\n") + 1);
+        // a bare name is left to PATH when the driver runs, which is only
+        // covered by the -v output
+        if (!fs::path(out).is_absolute()) continue;
+        std::error_code ec;
+        const auto prog = fs::canonical(out, ec);
+        if (!ec) toolchain.programs.emplace_back(prog);
+    }
+    std::set<fs::path> dirs;
+    for (auto lang : {"-xc", "-xc++"}) {
+        std::istringstream out(probe({driver, lang, "-E", "-v", "/dev/null"}));
+        std::string line;
+        bool listing = false;
+        while (std::getline(out, line)) {
+            if (line.rfind("#include <...> search starts here:", 0) == 0) {
+                listing = true;
+            } else if (line.rfind("End of search list.", 0) == 0) {
+                listing = false;
+            } else if (listing && line.rfind(' ', 0) == 0) {
+                std::error_code ec;
+                const auto dir = fs::canonical(line.substr(1), ec);
+                if (!ec) dirs.insert(dir);
+            }
+        }
+    }
+    toolchain.header_dirs.assign(dirs.begin(), dirs.end());
+    return toolchain;
+}
+
+/**
+ * @brief hash the mtime of dir and of the directories under it. headers are
+ * replaced by package upgrades, which touches the directories they are in
+ */
+static void hashDirStamp(Sha256 &hash, const fs::path &dir) {
+    std::vector<fs::path> dirs{dir};
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(dir, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->is_directory(ec) && !it->is_symlink(ec)) {
+            dirs.emplace_back(it->path());
+        }
+    }
+    std::sort(dirs.begin(), dirs.end());
+    for (const auto &path : dirs) {
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) {
+            hash.update(path.string());
+            hash.update(&st.st_mtim, sizeof(st.st_mtim));
+        }
+    }
+}
+
+static void hashToolchain(Sha256 &hash, const fs::path &driver,
+                          const struct stat &driver_st) {
+    // probed once per driver binary, its parts are checked on every key
+    static std::map<std::string, Toolchain> probed;
+    std::ostringstream id;
+    id << driver.string() << ' ' << driver_st.st_size << ' '
+       << driver_st.st_mtim.tv_sec << '.' << driver_st.st_mtim.tv_nsec;
+    auto it = probed.find(id.str());
+    if (it == probed.end()) {
+        it = probed.emplace(id.str(), probeToolchain(driver)).first;
+    }
+    const auto &toolchain = it->second;
+
+    hash.update("toolchain").update(toolchain.version);
+    for (const auto &prog : toolchain.programs) {
+        struct stat st;
+        if (stat(prog.c_str(), &st) == -1) {
+            throw std::runtime_error("failed to stat " + prog.string() + ": " +
+                                     strerror(errno));
+        }
+        hash.update(prog.string());
+        hash.update(&st.st_size, sizeof(st.st_size));
+        hash.update(&st.st_mtim, sizeof(st.st_mtim));
+    }
+    for (const auto &dir : toolchain.header_dirs) {
+        hashDirStamp(hash, dir);
+    }
+}
+
+std::string compileKey(const Config &conf,
+                       const std::vector<fs::path> &sources) {
+    Sha256 hash;
+    std::error_code ec;
+    const auto compiler = fs::canonical(findProgram(conf), ec);
+    if (ec) {
+        throw std::runtime_error("compiler " + conf.cmdline.at(0) +
+                                 " not found");
+    }
+    struct stat st;
+    if (stat(compiler.c_str(), &st) == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+    hash.update(compiler.string());
+    hash.update(&st.st_size, sizeof(st.st_size));
+    hash.update(&st.st_mtim, sizeof(st.st_mtim));
+    if (isGccDriver(compiler.filename()) ||
+        isGccDriver(conf.cmdline.at(0))) {
+        hashToolchain(hash, compiler, st);
+    }
+
+    hash.update("cmdline");
+    for (const auto &arg : conf.cmdline) hash.update(arg);
+    hash.update("env");
+    for (const auto &env : conf.env) hash.update(env);
+    hash.update("chdir").update(conf.chdir_path.string());
+
+    for (const auto &source : sources) {
+        const auto path = hostPath(conf, source);
+        if (path.empty()) {
+            throw std::runtime_error(source.string() +
+                                     " is not reachable from the host");
+        }
+        hash.update("source").update(source.string());
+        hashFile(hash, path);
+    }
+    return hash.hexdigest();
+}
+
+/**
+ * @brief copy the artifact src_fd refers to into a new file at tmp, with its
+ * mode. tmp is in a directory jails write, so whatever they put there is
+ * neither followed nor written through: it is removed, and the file is
+ * created anew
+ */
+static bool copyArtifact(int src_fd, const fs::path &tmp) {
+    struct stat st;
+    if (fstat(src_fd, &st) == -1) {
+        return false;
+    }
+    int fd = -1;
+    for (int tries = 0; fd == -1 && tries < 2; ++tries) {
+        fd = open(tmp.c_str(),
+                  O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd == -1 && (errno != EEXIST || unlink(tmp.c_str()) == -1)) {
+            return false;
+        }
+    }
+    if (fd == -1) {
+        return false;
+    }
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        ssize_t sz = sendfile(fd, src_fd, &offset, st.st_size - offset);
+        if (sz <= 0) {
+            if (sz == 0) errno = EIO;
+            break;
+        }
+    }
+    bool copied = offset == st.st_size && fchmod(fd, st.st_mode & 07777) == 0;
+    int err = errno;
+    close(fd);
+    if (!copied) {
+        unlink(tmp.c_str());
+        errno = err;
+    }
+    return copied;
+}
+
+ArtifactStore::ArtifactStore(const fs::path &dir, uintmax_t max_size)
+    : dir_(dir), max_size_(max_size) {
+    fs::create_directories(dir_);
+}
+
+bool ArtifactStore::fetch(const std::string &key, const fs::path &dest,
+                          int stderr_fd) {
+    const auto entry = dir_ / key;
+    // open first, so that eviction can not pull the entry from under us
+    int fd = open((entry / artifact_name).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    int err_fd = open((entry / stderr_name).c_str(), O_RDONLY | O_CLOEXEC);
+    if (err_fd == -1) {
+        close(fd);
+        return false;
+    }
+
+    const auto tmp =
+        dest.parent_path() / (tmp_prefix + std::to_string(getpid()) + "-" +
+                              dest.filename().string());
+    std::error_code ec;
+    if (!copyArtifact(fd, tmp)) {
+        ec = std::error_code(errno, std::generic_category());
+    }
+    if (!ec) {
+        fs::rename(tmp, dest, ec);
+    }
+    std::string err;
+    if (!ec) {
+        try {
+            err = readAllFromFd(err_fd);
+        } catch (const std::exception &e) {
+            ec = std::error_code(errno, std::generic_category());
+        }
+    }
+    struct stat st;
+    uintmax_t size = err.size();
+    if (fstat(fd, &st) == 0) size += st.st_size;
+    close(fd);
+    close(err_fd);
+    if (ec) {
+        LOG(WARNING) << "failed to fetch " << entry << ": " << ec.message();
+        fs::remove(tmp, ec);
+        return false;
+    }
+    if (!writeToFd(stderr_fd, err.data(), err.size())) {
+        LOG(WARNING) << "failed to write stderr of " << entry << ": "
+                     << strerror(errno);
+    }
+    use_(key, size);
+    return true;
+}
+
+void ArtifactStore::publish(const std::string &key, const fs::path &src,
+                            const fs::path &stderr_src) {
+    const auto tmp =
+        dir_ / (tmp_prefix + std::to_string(getpid()) + "-" + key);
+    std::error_code ec;
+    fs::remove_all(tmp, ec);
+    uintmax_t size;
+    try {
+        fs::create_directory(tmp);
+        fs::copy_file(src, tmp / artifact_name);
+        fs::copy_file(stderr_src, tmp / stderr_name);
+        fs::permissions(tmp / stderr_name, fs::perms(0644));
+        size = fs::file_size(tmp / artifact_name) +
+               fs::file_size(tmp / stderr_name);
+    } catch (const std::exception &e) {
+        fs::remove_all(tmp, ec);
+        throw;
+    }
+
+    uintmax_t total;
+    int lock_fd = lock_(total);
+    // other readers of the same key may be running, make them see it whole.
+    // an entry published meanwhile by another writer of the key is kept
+    bool added = rename(tmp.c_str(), (dir_ / key).c_str()) == 0;
+    if (!added) {
+        int err = errno;
+        fs::remove_all(tmp, ec);
+        if (err != EEXIST && err != ENOTEMPTY) {
+            close(lock_fd);
+            throw std::runtime_error("failed to publish " + key + ": " +
+                                     strerror(err));
+        }
+    } else {
+        use_(key, size);
+        total += size;
+    }
+    try {
+        if (total > max_size_ ||
+            fs::file_size(dir_ / journal_name, ec) > max_journal_size) {
+            total = compact_(total);
+        }
+        const auto str = std::to_string(total);
+        if (ftruncate(lock_fd, 0) == -1 ||
+            pwrite(lock_fd, str.data(), str.size(), 0) !=
+                (ssize_t)str.size()) {
+            throw std::runtime_error(std::string("failed to write size: ") +
+                                     strerror(errno));
+        }
+    } catch (const std::exception &e) {
+        close(lock_fd);
+        throw;
+    }
+    close(lock_fd);
+}
+
+void ArtifactStore::use_(const std::string &key, uintmax_t size) {
+    // a single append of a short line, which concurrent users do not tear
+    const auto line = key + " " + std::to_string(size) + "\n";
+    int fd = open((dir_ / journal_name).c_str(),
+                  O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1 || !writeToFd(fd, line.data(), line.size())) {
+        LOG(WARNING) << "failed to record use of " << key << ": "
+                     << strerror(errno);
+    }
+    if (fd != -1) close(fd);
+}
+
+/**
+ * @brief lock the store against other writers and get the total size of its
+ * entries, which is rebuilt from the entries if unknown
+ *
+ * @return fd of the size file to write the new total to and close
+ */
+int ArtifactStore::lock_(uintmax_t &total) {
+    const auto path = dir_ / size_name;
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1 || flock(fd, LOCK_EX) == -1) {
+        if (fd != -1) close(fd);
+        throw std::runtime_error("failed to lock " + path.string() + ": " +
+                                 strerror(errno));
+    }
+    try {
+        const auto str = readAllFromFd(fd);
+        total = str.empty() ? rebuild_() : std::stoull(str);
+    } catch (const std::exception &e) {
+        close(fd);
+        throw;
+    }
+    return fd;
+}
+
+/**
+ * @brief journal the entries found in the store, oldest first, and return
+ * their total size. entries of older versions, which were plain files, are
+ * dropped
+ */
+uintmax_t ArtifactStore::rebuild_() {
+    struct Entry {
+        std::string key;
+        uintmax_t size;
+        fs::file_time_type mtime;
+    };
+    std::vector<Entry> entries;
+    uintmax_t total = 0;
+
+    std::error_code ec;
+    for (const auto &file : fs::directory_iterator(dir_, ec)) {
+        const auto key = file.path().filename().string();
+        if (key[0] == '.') continue;
+        if (!file.is_directory(ec)) {
+            fs::remove(file.path(), ec);
+            continue;
+        }
+        uintmax_t size = 0;
+        for (auto name : {artifact_name, stderr_name}) {
+            const auto sz = fs::file_size(file.path() / name, ec);
+            size += ec ? 0 : sz;
+        }
+        entries.push_back({key, size, file.last_write_time(ec)});
+        total += size;
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) { return a.mtime < b.mtime; });
+    std::ofstream journal(dir_ / journal_name, std::ios::trunc);
+    for (const auto &entry : entries) {
+        journal << entry.key << ' ' << entry.size << '\n';
+    }
+    if (!journal.flush()) {
+        throw std::runtime_error("failed to write journal of " +
+                                 dir_.string());
+    }
+    return total;
+}
+
+/**
+ * @brief evict the least recently used entries until total is below the
+ * limit and rewrite the journal with one line per remaining entry
+ *
+ * @return the new total
+ */
+uintmax_t ArtifactStore::compact_(uintmax_t total) {
+    // the last use of each key decides its place
+    std::unordered_map<std::string, std::pair<size_t, uintmax_t>> uses;
+    {
+        std::ifstream in(dir_ / journal_name);
+        std::string key;
+        uintmax_t size;
+        for (size_t seq = 0; in >> key >> size; ++seq) {
+            uses[key] = {seq, size};
+        }
+    }
+    std::vector<std::pair<size_t, std::string>> order;
+    for (const auto &use : uses) {
+        order.emplace_back(use.second.first, use.first);
+    }
+    std::sort(order.begin(), order.end());
+
+    const auto tmp = dir_ / (tmp_prefix + std::to_string(getpid()) + "-" +
+                             journal_name);
+    std::ofstream journal(tmp, std::ios::trunc);
+    std::error_code ec;
+    for (const auto &entry : order) {
+        const auto size = uses[entry.second].second;
+        if (total > max_size_) {
+            // entries already removed by hand count as well
+            fs::remove_all(dir_ / entry.second, ec);
+            total -= std::min(total, size);
+            DLOG(INFO) << "evicted " << entry.second;
+        } else {
+            journal << entry.second << ' ' << size << '\n';
+        }
+    }
+    if (!journal.flush()) {
+        throw std::runtime_error("failed to write journal of " +
+                                 dir_.string());
+    }
+    journal.close();
+    // uses appended since it was read are lost, which only ages those
+    // entries
+    fs::rename(tmp, dir_ / journal_name);
+
+    const auto now = fs::file_time_type::clock::now();
+    for (const auto &file : fs::directory_iterator(dir_, ec)) {
+        if (file.path().filename().string().rfind(tmp_prefix, 0) == 0 &&
+            now - file.last_write_time(ec) > stale_tmp_age) {
+            fs::remove_all(file.path(), ec);
+        }
+    }
+    return total;
+}
+
+}  // namespace yamc
@@ -0,0 +1,59 @@
+#ifndef ARTIFACT_H_
+#define ARTIFACT_H_
+
+#include "config.h"
+
+namespace yamc {
+
+/**
+ * content addressed store of build artifacts, e.g. compiled submissions,
+ * along with what the build wrote to stderr, e.g. warnings
+ *
+ * entries are directories named by their key. they are published atomically
+ * by rename, so readers only ever see complete entries, and an entry being
+ * copied out stays readable even if it is evicted meanwhile. the store is
+ * kept below its size limit by evicting least recently used entries first,
+ * as recorded by a journal every use appends to, so that publishing does not
+ * have to look at every entry
+ */
+class ArtifactStore {
+   private:
+    fs::path dir_;
+    uintmax_t max_size_;
+
+    void use_(const std::string &key, uintmax_t size);
+    int lock_(uintmax_t &total);
+    uintmax_t rebuild_();
+    uintmax_t compact_(uintmax_t total);
+
+   public:
+    ArtifactStore(const fs::path &dir, uintmax_t max_size);
+
+    /**
+     * @brief copy the entry of key to dest and write its stderr to
+     * stderr_fd. return false on a miss
+     *
+     */
+    bool fetch(const std::string &key, const fs::path &dest, int stderr_fd);
+
+    /**
+     * @brief store a copy of src and stderr_src as the entry of key
+     *
+     */
+    void publish(const std::string &key, const fs::path &src,
+                 const fs::path &stderr_src);
+};
+
+/**
+ * @brief key of the compilation run by conf: the compiler binary, cmdline,
+ * env, chdir and the names and content of sources, as seen inside the jail.
+ * for gcc and clang also the toolchain behind the driver: its -v output, the
+ * programs it runs such as cc1plus, and the directories of its headers
+ *
+ */
+std::string compileKey(const Config &conf,
+                       const std::vector<fs::path> &sources);
+
+}  // namespace yamc
+
+#endif  // ARTIFACT_H_
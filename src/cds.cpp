@@ -0,0 +1,188 @@
+#include "cds.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "jail.h"
+#include "sha256.h"
+#include "utils.h"
+
+namespace yamc {
+
+static const char dump_dir[] = "/.yamc/cds-dump";
+// programs that failed to dump, possibly because of a transient limit hit,
+// are retried after this long
+static const auto failed_retry_age = std::chrono::hours(1);
+
+/**
+ * @brief hash the size of the file at path, then its content, so that the
+ * bytes of a file can not pass for the names and content of the next one.
+ * return false if it can not be read, or changes while it is read
+ */
+static bool hashFile(Sha256 &hash, const fs::path &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) close(fd);
+        return false;
+    }
+    const uint64_t size = st.st_size;
+    hash.update(&size, sizeof(size));
+    static const size_t buf_sz = 64 * 1024;
+    std::vector<char> buf(buf_sz);
+    ssize_t sz;
+    uint64_t total = 0;
+    while ((sz = TEMP_FAILURE_RETRY(read(fd, buf.data(), buf_sz))) > 0) {
+        hash.update(buf.data(), sz);
+        total += sz;
+    }
+    close(fd);
+    return sz == 0 && total == size;
+}
+
+/**
+ * @brief hash the names and content of the files at path. return false if
+ * some can not be read, so that the key would not cover them
+ */
+static bool hashPath(Sha256 &hash, const fs::path &path) {
+    std::error_code ec;
+    if (!fs::is_directory(path, ec)) {
+        return hashFile(hash, path);
+    }
+    std::vector<fs::path> files;
+    for (auto it = fs::recursive_directory_iterator(path, ec);
+         it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) {
+            return false;
+        }
+        if (it->is_regular_file(ec)) {
+            files.emplace_back(it->path());
+        }
+    }
+    if (ec) {
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+    for (const auto &file : files) {
+        hash.update(file.lexically_relative(path).string());
+        if (!hashFile(hash, file)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::string classPath(const Config &conf) {
+    const auto &args = conf.cmdline;
+    std::string jar, cp;
+    for (size_t i = 1; i < args.size() && args[i].rfind('-', 0) == 0; ++i) {
+        const auto &arg = args[i];
+        if (arg == "-jar" && i + 1 < args.size()) {
+            jar = args[++i];
+            break;
+        } else if ((arg == "-cp" || arg == "-classpath" ||
+                    arg == "--class-path") &&
+                   i + 1 < args.size()) {
+            cp = args[++i];
+        } else if (arg.rfind("--class-path=", 0) == 0) {
+            cp = arg.substr(strlen("--class-path="));
+        }
+    }
+    if (!jar.empty()) {
+        return jar;
+    }
+    if (!cp.empty()) {
+        return cp;
+    }
+    for (const auto &env : conf.env) {
+        if (env.rfind("CLASSPATH=", 0) == 0) {
+            return env.substr(strlen("CLASSPATH="));
+        }
+    }
+    return ".";
+}
+
+void useCdsArchive(Config &conf) {
+    if (conf.cds_cache.empty() || conf.cmdline.empty() ||
+        fs::path(conf.cmdline[0]).filename() != "java") {
+        return;
+    }
+    for (const auto &arg : conf.cmdline) {
+        if (arg.rfind("-Xshare", 0) == 0 ||
+            arg.find("SharedArchiveFile") != std::string::npos ||
+            arg.find("ArchiveClassesAtExit") != std::string::npos) {
+            return;
+        }
+    }
+
+    std::error_code ec;
+    const auto java = fs::canonical(findProgram(conf), ec);
+    struct stat st;
+    if (ec || stat(java.c_str(), &st) == -1) {
+        return;
+    }
+    // the archive is written by the program itself, so it is shared only
+    // between runs of the very same classes in the very same environment
+    Sha256 hash;
+    hash.update(java.string());
+    hash.update(&st.st_size, sizeof(st.st_size));
+    hash.update(&st.st_mtim, sizeof(st.st_mtim));
+    hash.update("cmdline");
+    for (const auto &arg : conf.cmdline) hash.update(arg);
+    hash.update("env");
+    for (const auto &env : conf.env) hash.update(env);
+    hash.update("chdir").update(conf.chdir_path.string());
+    const auto cp = classPath(conf);
+    size_t begin = 0, end;
+    do {
+        end = cp.find(':', begin);
+        const auto entry = cp.substr(begin, end - begin);
+        const auto path = hostPath(conf, entry);
+        hash.update("classpath").update(entry);
+        if (path.empty() || !hashPath(hash, path)) {
+            DLOG(INFO) << "classpath " << entry << " not readable, no cds";
+            return;
+        }
+        begin = end + 1;
+    } while (end != std::string::npos);
+
+    const auto name = hash.hexdigest() + ".jsa";
+    const auto archive = conf.cds_cache / name;
+    const auto failed = conf.cds_cache / (name + ".failed");
+    if (!fs::exists(archive)) {
+        // do not retry programs that failed to dump, e.g. on an old jdk, for
+        // a while
+        const auto failed_at = fs::last_write_time(failed, ec);
+        if (!ec && fs::file_time_type::clock::now() - failed_at <
+                       failed_retry_age) {
+            return;
+        }
+        DLOG(INFO) << "dumping cds archive " << archive;
+        Config dump = conf;
+        dump.cmdline.insert(dump.cmdline.begin() + 1,
+                            std::string("-XX:ArchiveClassesAtExit=") +
+                                dump_dir + "/archive.jsa");
+        if (!buildInJail(dump, dump_dir, "archive.jsa", archive)) {
+            int fd = open(failed.c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd != -1) {
+                // mark the time of this failure, not of the first one
+                futimens(fd, nullptr);
+                close(fd);
+            }
+            return;
+        }
+        fs::remove(failed, ec);
+    }
+    conf.cmdline.insert(conf.cmdline.begin() + 1,
+                        {"-XX:SharedArchiveFile=" +
+                             (Config::cds_mount_point / name).string(),
+                         "-Xshare:auto"});
+}
+
+}  // namespace yamc
@@ -0,0 +1,25 @@
+#ifndef CDS_H_
+#define CDS_H_
+
+#include "config.h"
+
+namespace yamc {
+
+/**
+ * @brief let a java program start from a class data sharing archive kept in
+ * conf.cds_cache, which jails mount read only at Config::cds_mount_point
+ *
+ * archives are keyed by a sha-256 of the jdk, the cmdline, env, chdir and
+ * the content of the classpath. a missing archive is dumped by running the
+ * program once in a jail of its own with -XX:ArchiveClassesAtExit, and
+ * published atomically. since the program may write anything as its
+ * archive, it is only ever used by the same program again. conf is left as
+ * is if it does not run java, the classpath is not readable from the host,
+ * or no archive can be dumped
+ *
+ */
+void useCdsArchive(Config &conf);
+
+}  // namespace yamc
+
+#endif  // CDS_H_
@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <glog/logging.h>
 #include <glog/raw_logging.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -18,6 +19,11 @@ Cgroup::Cgroup() {
     static std::mt19937_64 rd64(rd());
     name_ = std::string("yamc") + std::to_string(rd64());
     RAW_DLOG(INFO, "cgroup name is %s", name_.c_str());
+    cpu_ = baseDir_ / "cpu" / "yamc" / name_;
+    cpuacct_ = baseDir_ / "cpuacct" / "yamc" / name_;
+    memory_ = baseDir_ / "memory" / "yamc" / name_;
+    pids_ = baseDir_ / "pids" / "yamc" / name_;
+    procs_ = pids_ / "cgroup.procs";
     fs::create_directory(getSubsysPath_(CG_SUBSYS::CPU));
     fs::create_directory(getSubsysPath_(CG_SUBSYS::CPUACCT));
     fs::create_directory(getSubsysPath_(CG_SUBSYS::MEMORY));
@@ -53,24 +59,19 @@ void Cgroup::attach(pid_t pid) const {
 }
 
 const std::filesystem::path &Cgroup::getSubsysPath_(CG_SUBSYS subsys) const {
-    namespace fs = std::filesystem;
-    std::filesystem::path *ret = nullptr;
+    const std::filesystem::path *ret = nullptr;
     switch (subsys) {
         case CG_SUBSYS::CPU:
-            static fs::path cpu = baseDir_ / "cpu" / "yamc" / name_;
-            ret = &cpu;
+            ret = &cpu_;
             break;
         case CG_SUBSYS::CPUACCT:
-            static fs::path cpuacct = baseDir_ / "cpuacct" / "yamc" / name_;
-            ret = &cpuacct;
+            ret = &cpuacct_;
             break;
         case CG_SUBSYS::MEMORY:
-            static fs::path memory = baseDir_ / "memory" / "yamc" / name_;
-            ret = &memory;
+            ret = &memory_;
             break;
         case CG_SUBSYS::PIDS:
-            static fs::path pids = baseDir_ / "pids" / "yamc" / name_;
-            ret = &pids;
+            ret = &pids_;
             break;
         default:
             throw std::runtime_error("unknown cgroup subsystem");
@@ -83,6 +84,68 @@ void Cgroup::resetTimer() const {
     writeTo_(CG_SUBSYS::CPUACCT, "cpuacct.usage", std::string("0"));
 }
 
+void Cgroup::resetMemoryUsage() const {
+    writeTo_(CG_SUBSYS::MEMORY, "memory.max_usage_in_bytes", 0);
+    writeTo_(CG_SUBSYS::MEMORY, "memory.memsw.max_usage_in_bytes", 0);
+}
+
+void Cgroup::reclaimMemory() const {
+    try {
+        writeTo_(CG_SUBSYS::MEMORY, "memory.force_empty", 0);
+    } catch (const std::exception &e) {
+        // e.g. EBUSY if a process killed has not left yet
+        RAW_LOG(WARNING, "failed to reclaim memory of %s", name_.c_str());
+    }
+}
+
+std::vector<pid_t> Cgroup::getProcs() const {
+    std::vector<pid_t> procs;
+    std::ifstream ifs;
+    ifs.exceptions(std::ifstream::badbit);
+    ifs.open(getSubsysPath_(CG_SUBSYS::PIDS) / "cgroup.procs");
+    for (pid_t pid; ifs >> pid;) {
+        procs.emplace_back(pid);
+    }
+    return procs;
+}
+
+void Cgroup::killAll() const {
+    // processes may keep forking while we are killing them. pids.max makes
+    // sure this terminates
+    for (auto procs = getProcs(); !procs.empty(); procs = getProcs()) {
+        for (auto pid : procs) {
+            if (kill(pid, SIGKILL) == -1 && errno != ESRCH) {
+                throw std::runtime_error(strerror(errno));
+            }
+        }
+    }
+}
+
+bool Cgroup::killAllBut(pid_t keep) const {
+    int fd = open(procs_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    char buf[512];
+    pid_t pid = 0;
+    ssize_t sz;
+    while ((sz = TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf)))) > 0) {
+        // one pid per line, which may span reads
+        for (ssize_t i = 0; i < sz; ++i) {
+            if (buf[i] >= '0' && buf[i] <= '9') {
+                pid = pid * 10 + (buf[i] - '0');
+                continue;
+            }
+            if (pid != 0 && pid != keep) {
+                kill(pid, SIGKILL);
+            }
+            pid = 0;
+        }
+    }
+    close(fd);
+    return sz == 0;
+}
+
 long long Cgroup::getTimeUsrUsage() const {
     return readFrom_<long long>(CG_SUBSYS::CPUACCT, "cpuacct.usage_user");
 }
@@ -12,6 +12,8 @@ class Cgroup {
     const std::filesystem::path &getSubsysPath_(CG_SUBSYS subsys) const;
 
     std::string name_;
+    std::filesystem::path memory_, cpu_, cpuacct_, pids_;
+    std::string procs_;  // cgroup.procs of pids_
 
     template <typename T>
     T readFrom_(CG_SUBSYS subsys, const std::string &filename) const;
@@ -29,6 +31,36 @@ class Cgroup {
 
     void resetTimer() const;
 
+    /**
+     * @brief reset the max memory usage to the current usage
+     */
+    void resetMemoryUsage() const;
+
+    /**
+     * @brief uncharge the memory still charged to this cgroup, e.g. page cache
+     * of files read by processes that are gone. the cgroup has to be empty
+     */
+    void reclaimMemory() const;
+
+    /**
+     * @brief pids of processes in this cgroup, as seen from the caller's pid
+     * namespace
+     */
+    std::vector<pid_t> getProcs() const;
+
+    /**
+     * @brief SIGKILL every process in this cgroup until it is empty
+     */
+    void killAll() const;
+
+    /**
+     * @brief SIGKILL every process in this cgroup but keep, once. it does not
+     * allocate, so that the killer thread of a jail can call it
+     *
+     * @return false if the processes could not be listed
+     */
+    bool killAllBut(pid_t keep) const;
+
     /**
      * @brief Get the time usage (user) in nanoseconds
      */
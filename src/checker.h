@@ -0,0 +1,48 @@
+#ifndef CHECKER_H_
+#define CHECKER_H_
+
+/*
+ * interface of trusted checker plugins, shared objects loaded by yamc and
+ * called in-process instead of running a checker in a jail. a plugin exports
+ *
+ *     int yamc_check(const struct yamc_check_request *req,
+ *                    struct yamc_check_reply *reply);
+ *
+ * which returns 0 once the output is judged, or non-zero if the check itself
+ * failed, e.g. on invalid arguments. buffers of the request are read-only
+ * mappings of the files and are not null-terminated. reply is zeroed before
+ * the call, and score defaults to 1 for accepted outputs if left 0.
+ *
+ * plugins run with all the privileges of yamc, so only load trusted ones.
+ *
+ * this header is kept C compatible, it is shared with src/plugins.
+ */
+
+#include <stddef.h>
+
+#define YAMC_CHECK_SYMBOL "yamc_check"
+#define YAMC_CHECK_MESSAGE_SIZE 1024
+
+struct yamc_buffer {
+    const char *data;
+    size_t size;
+};
+
+struct yamc_check_request {
+    struct yamc_buffer input; /* empty if the input is not kept */
+    struct yamc_buffer output;
+    struct yamc_buffer answer;
+    int argc; /* extra arguments given by the check */
+    const char *const *argv;
+};
+
+struct yamc_check_reply {
+    int accepted;
+    double score;
+    char message[YAMC_CHECK_MESSAGE_SIZE]; /* null-terminated */
+};
+
+typedef int (*yamc_check_fn)(const struct yamc_check_request *req,
+                             struct yamc_check_reply *reply);
+
+#endif /* CHECKER_H_ */
@@ -15,7 +15,7 @@ namespace yamc {
 namespace fs = std::filesystem;
 
 struct MountPt {
-    enum class MNT_TYPE { ROBIND, RWBIND, TMPFS };
+    enum class MNT_TYPE { ROBIND, RWBIND, TMPFS, OVERLAY };
     fs::path src;
     fs::path dest;
     std::string option;
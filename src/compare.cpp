@@ -0,0 +1,375 @@
+#include "compare.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+
+#include "mapping.h"
+
+namespace yamc {
+
+static const size_t max_quoted = 32;
+static const size_t max_number = 64;
+
+static bool isSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+/**
+ * @brief length of the common prefix of a and b, which are n bytes long
+ */
+static size_t mismatchScalar(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if (x != y) break;
+    }
+    while (i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+#if defined(__x86_64__)
+static size_t mismatchSse2(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        auto y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        unsigned diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+        if (diff != 0) return i + __builtin_ctz(diff);
+    }
+    return i + mismatchScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t mismatchAvx2(const char *a,
+                                                            const char *b,
+                                                            size_t n) {
+    size_t i = 0;
+    // two vectors per iteration, the difference is located below
+    for (; i + 64 <= n; i += 64) {
+        auto x0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        auto y0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        auto x1 =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i + 32));
+        auto y1 =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i + 32));
+        auto eq = _mm256_and_si256(_mm256_cmpeq_epi8(x0, y0),
+                                   _mm256_cmpeq_epi8(x1, y1));
+        if (static_cast<unsigned>(_mm256_movemask_epi8(eq)) != ~0u) break;
+    }
+    for (; i + 32 <= n; i += 32) {
+        auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        unsigned diff = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (diff != 0) return i + __builtin_ctz(diff);
+    }
+    return i + mismatchSse2(a + i, b + i, n - i);
+}
+#endif
+
+using mismatch_fn = size_t (*)(const char *, const char *, size_t);
+
+static mismatch_fn selectMismatch() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return mismatchAvx2;
+    return mismatchSse2;
+#else
+    return mismatchScalar;
+#endif
+}
+
+static size_t mismatch(const char *a, const char *b, size_t n) {
+    static const mismatch_fn fn = selectMismatch();
+    return fn(a, b, n);
+}
+
+struct Difference {
+    size_t offset;  // in output
+    std::string expected, found;
+};
+
+/**
+ * @brief at most max_quoted bytes from begin, to be shown in messages
+ */
+static std::string quote(const char *begin, const char *end) {
+    if (begin == end) return "EOF";
+    std::string s(begin, std::min<size_t>(end - begin, max_quoted));
+    // keep the json valid utf-8
+    for (auto &c : s) {
+        if (static_cast<unsigned char>(c) >= 0x80) c = '?';
+    }
+    return s;
+}
+
+static bool parseNumber(const char *begin, const char *end, double &val) {
+    char buf[max_number];
+    size_t len = end - begin;
+    if (len == 0 || len >= sizeof(buf)) return false;
+    memcpy(buf, begin, len);
+    buf[len] = '\0';
+    char *num_end;
+    val = strtod(buf, &num_end);
+    return *num_end == '\0' && val == val;
+}
+
+static bool closeNumbers(const char *a, const char *a_end, const char *b,
+                         const char *b_end, double eps) {
+    double x, y;
+    if (!parseNumber(a, a_end, x) || !parseNumber(b, b_end, y)) {
+        return false;
+    }
+    double diff = std::abs(x - y);
+    return diff <= eps || diff <= eps * std::abs(y);
+}
+
+/*
+ * the comparisons below start from output[i] and answer[j], and leave i and j
+ * where they stop. with partial, output may be followed by more, so they stop
+ * without a difference at the token output ends in, or as far as the line it
+ * ends in can still match, from where they are resumed once more output is
+ * appended
+ */
+
+static std::optional<Difference> compareExact(const char *a, size_t na,
+                                              const char *b, size_t nb,
+                                              size_t &i, size_t &j,
+                                              bool partial) {
+    size_t n = mismatch(a + i, b + j, std::min(na - i, nb - j));
+    i += n;
+    j += n;
+    if ((i == na && (partial || j == nb))) return std::nullopt;
+    return Difference{i, quote(b + j, b + nb), quote(a + i, a + na)};
+}
+
+/**
+ * @brief compare tokens, numbers with eps if it is not negative
+ */
+static std::optional<Difference> compareTokens(const char *a, size_t na,
+                                               const char *b, size_t nb,
+                                               double eps, size_t &i,
+                                               size_t &j, bool partial) {
+    for (;;) {
+        // skip the common prefix, back to the token the difference is in
+        size_t n = mismatch(a + i, b + j, std::min(na - i, nb - j));
+        while (n > 0 && !isSpace(a[i + n - 1])) --n;
+        i += n;
+        j += n;
+
+        while (i < na && isSpace(a[i])) ++i;
+        while (j < nb && isSpace(b[j])) ++j;
+        if (i == na && (partial || j == nb)) return std::nullopt;
+        size_t ei = i, ej = j;
+        while (ei < na && !isSpace(a[ei])) ++ei;
+        while (ej < nb && !isSpace(b[ej])) ++ej;
+        if (partial && ei == na && j < nb) return std::nullopt;
+        bool same = ei - i == ej - j && memcmp(a + i, b + j, ei - i) == 0;
+        if (!same && !(eps >= 0 && i < na && j < nb &&
+                       closeNumbers(a + i, a + ei, b + j, b + ej, eps))) {
+            return Difference{i, quote(b + j, b + ej), quote(a + i, a + ei)};
+        }
+        i = ei;
+        j = ej;
+    }
+}
+
+static size_t trimLine(const char *s, size_t begin, size_t end) {
+    while (end > begin && isSpace(s[end - 1])) --end;
+    return end;
+}
+
+static bool blank(const char *s, size_t begin, size_t end) {
+    return trimLine(s, begin, end) == begin;
+}
+
+static std::optional<Difference> compareLines(const char *a, size_t na,
+                                              const char *b, size_t nb,
+                                              size_t &i, size_t &j,
+                                              bool partial) {
+    for (;;) {
+        // skip the common prefix, back to the line the difference is in
+        size_t n = mismatch(a + i, b + j, std::min(na - i, nb - j));
+        auto line = static_cast<const char *>(memrchr(a + i, '\n', n));
+        n = line ? line + 1 - (a + i) : 0;
+        i += n;
+        j += n;
+
+        auto line_a = static_cast<const char *>(memchr(a + i, '\n', na - i));
+        if (partial && !line_a) {
+            // consume what the unfinished line has in common with the answer,
+            // which cannot span a newline. the answer is not searched for the
+            // end of its line before, or long lines would be scanned over and
+            // over
+            n = mismatch(a + i, b + j, std::min(na - i, nb - j));
+            i += n;
+            j += n;
+            if (i == na) return std::nullopt;
+            auto line_b =
+                static_cast<const char *>(memchr(b + j, '\n', nb - j));
+            size_t ej = line_b ? line_b - b : nb;
+            // past that, both have to be trailing whitespace
+            size_t ti = trimLine(a, i, na);
+            if (ti != i || !blank(b, j, ej)) {
+                return Difference{i, quote(b + j, b + trimLine(b, j, ej)),
+                                  quote(a + i, a + ti)};
+            }
+            // and the rest of the output line is to be blank
+            i = na;
+            j = ej;
+            return std::nullopt;
+        }
+        auto line_b = static_cast<const char *>(memchr(b + j, '\n', nb - j));
+        size_t ei = line_a ? line_a - a : na, ej = line_b ? line_b - b : nb;
+        size_t ti = trimLine(a, i, ei), tj = trimLine(b, j, ej);
+        // trailing empty lines are ignored
+        if (j == nb && ti == i && i < na) {
+            i = std::min(ei + 1, na);
+            continue;
+        }
+        if ((i == na || j == nb) && blank(a, i, na) && blank(b, j, nb)) {
+            return std::nullopt;
+        }
+        if (i == na || j == nb || ti - i != tj - j ||
+            memcmp(a + i, b + j, ti - i) != 0) {
+            // lines can be long, point at the difference within them
+            n = mismatch(a + i, b + j, std::min(ti - i, tj - j));
+            return Difference{i + n, quote(b + j + n, b + tj),
+                              quote(a + i + n, a + ti)};
+        }
+        i = std::min(ei + 1, na);
+        j = std::min(ej + 1, nb);
+    }
+}
+
+nlohmann::json Comparator::accepted() {
+    return {{"verdict", "ok"}, {"score", 1}, {"message", ""}};
+}
+
+Comparator::Comparator(const nlohmann::json &desc)
+    : mode_(MODE::TOKENS), eps_(1e-6) {
+    static const std::pair<const char *, MODE> modes[] = {
+        {"exact", MODE::EXACT},
+        {"tokens", MODE::TOKENS},
+        {"lines", MODE::LINES},
+        {"float", MODE::FLOAT},
+    };
+    if (!desc.is_object()) {
+        throw std::runtime_error("invalid compare");
+    }
+    if (desc.contains("mode")) {
+        const auto mode = desc.at("mode").get<std::string>();
+        auto it = std::find_if(std::begin(modes), std::end(modes),
+                               [&](const auto &m) { return mode == m.first; });
+        if (it == std::end(modes)) {
+            throw std::runtime_error("unknown compare mode " + mode);
+        }
+        mode_ = it->second;
+    }
+    if (desc.contains("eps")) {
+        eps_ = desc.at("eps").get<double>();
+        if (!(eps_ >= 0)) {
+            throw std::runtime_error("invalid value of eps");
+        }
+    }
+}
+
+nlohmann::json Comparator::scan_(const char *output, size_t output_size,
+                                 const char *answer, size_t answer_size,
+                                 size_t &i, size_t &j, bool partial) const {
+    std::optional<Difference> diff;
+    switch (mode_) {
+        case MODE::EXACT:
+            diff = compareExact(output, output_size, answer, answer_size, i, j,
+                                partial);
+            break;
+        case MODE::TOKENS:
+            diff = compareTokens(output, output_size, answer, answer_size, -1,
+                                 i, j, partial);
+            break;
+        case MODE::LINES:
+            diff = compareLines(output, output_size, answer, answer_size, i, j,
+                                partial);
+            break;
+        case MODE::FLOAT:
+            diff = compareTokens(output, output_size, answer, answer_size,
+                                 eps_, i, j, partial);
+            break;
+    }
+    if (!diff) {
+        return nullptr;
+    }
+    return {{"verdict", "wa"},
+            {"score", 0},
+            {"offset", diff->offset},
+            {"message", "expected " + diff->expected + ", found " +
+                            diff->found}};
+}
+
+nlohmann::json Comparator::compare(const char *output, size_t output_size,
+                                   const char *answer,
+                                   size_t answer_size) const {
+    size_t i = 0, j = 0;
+    auto res = scan_(output, output_size, answer, answer_size, i, j, false);
+    if (res.is_null()) {
+        return accepted();
+    }
+    return res;
+}
+
+nlohmann::json Comparator::compare(const fs::path &output,
+                                   const fs::path &answer) const {
+    // the output was written by the submission, which may still hold it
+    MappedFile out{output, true}, ans{answer};
+    return compare(out.data(), out.size(), ans.data(), ans.size());
+}
+
+nlohmann::json Comparator::compare(int output_fd, int answer_fd) const {
+    MappedFile out{output_fd, true}, ans{answer_fd};
+    return compare(out.data(), out.size(), ans.data(), ans.size());
+}
+
+StreamComparison::StreamComparison(const Comparator &comparator,
+                                   const fs::path &answer)
+    : comparator_(comparator),
+      answer_(answer),
+      offset_(0),
+      resume_(0),
+      answer_pos_(0) {}
+
+bool StreamComparison::feed(const char *buf, size_t len) {
+    if (!verdict_.is_null()) {
+        return false;
+    }
+    pending_.append(buf, len);
+    verdict_ = comparator_.scan_(pending_.data(), pending_.size(),
+                                 answer_.data(), answer_.size(), resume_,
+                                 answer_pos_, true);
+    if (!verdict_.is_null()) {
+        verdict_["offset"] = offset_ + verdict_.at("offset").get<size_t>();
+        return false;
+    }
+    // output before where the comparison is resumed is not needed anymore
+    pending_.erase(0, resume_);
+    offset_ += resume_;
+    resume_ = 0;
+    return true;
+}
+
+nlohmann::json StreamComparison::finish() {
+    if (verdict_.is_null()) {
+        verdict_ = comparator_.scan_(pending_.data(), pending_.size(),
+                                     answer_.data(), answer_.size(), resume_,
+                                     answer_pos_, false);
+        if (verdict_.is_null()) {
+            verdict_ = Comparator::accepted();
+        } else {
+            verdict_["offset"] = offset_ + verdict_.at("offset").get<size_t>();
+        }
+    }
+    return verdict_;
+}
+
+}  // namespace yamc
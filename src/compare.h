@@ -0,0 +1,109 @@
+#ifndef COMPARE_H_
+#define COMPARE_H_
+
+#include "common.h"
+#include "mapping.h"
+
+namespace yamc {
+
+/**
+ * built-in comparison of an output against the answer, without a checker.
+ * common prefixes are skipped with vectorized compares (AVX2 or SSE2 if the
+ * cpu has them), so that only the bytes around differences are scanned one by
+ * one. modes are
+ *  - exact: byte by byte
+ *  - tokens: whitespace separated tokens
+ *  - lines: lines with trailing whitespace stripped, ignoring trailing empty
+ *    lines
+ *  - float: like tokens, but numbers may differ by eps, absolute or relative
+ */
+class Comparator {
+   public:
+    enum class MODE { EXACT, TOKENS, LINES, FLOAT };
+
+   private:
+    MODE mode_;
+    double eps_;
+
+    /**
+     * @brief compare from output[i] and answer[j] on, see compare.cpp
+     *
+     * @return verdict of the difference found, null if none
+     */
+    nlohmann::json scan_(const char *output, size_t output_size,
+                         const char *answer, size_t answer_size, size_t &i,
+                         size_t &j, bool partial) const;
+
+    friend class StreamComparison;
+
+   public:
+    Comparator() = delete;
+
+    /**
+     * @brief desc is {"mode": "exact" | "tokens" | "lines" | "float",
+     * "eps": 1e-6}, mode defaulting to tokens and eps to 1e-6
+     */
+    explicit Comparator(const nlohmann::json &desc);
+
+    /**
+     * @return {"verdict": "ok" or "wa", "score": 1 or 0, "message": ...}
+     * with the byte offset of the first difference in output as "offset"
+     * if they differ
+     */
+    nlohmann::json compare(const char *output, size_t output_size,
+                           const char *answer, size_t answer_size) const;
+
+    /**
+     * @brief compare regular files, mapped into memory. the output is copied
+     * first, as whoever wrote it may still truncate it
+     */
+    nlohmann::json compare(const fs::path &output,
+                           const fs::path &answer) const;
+
+    /**
+     * @brief compare regular files fds refer to, mapped into memory, the
+     * output copied first
+     */
+    nlohmann::json compare(int output_fd, int answer_fd) const;
+
+    /**
+     * @brief verdict of an output that is the same as the answer
+     */
+    static nlohmann::json accepted();
+};
+
+/**
+ * comparison of an output fed chunk by chunk as it is produced, against an
+ * answer file mapped into memory. only the output after the last token
+ * known to match, or the part of the line that may still differ, is kept
+ */
+class StreamComparison {
+   private:
+    const Comparator &comparator_;
+    MappedFile answer_;
+    std::string pending_;  // output from offset_ on
+    size_t offset_, resume_, answer_pos_;
+    nlohmann::json verdict_;
+
+   public:
+    StreamComparison() = delete;
+    StreamComparison(StreamComparison const &) = delete;
+    StreamComparison &operator=(StreamComparison const &) = delete;
+    StreamComparison(const Comparator &comparator, const fs::path &answer);
+
+    /**
+     * @brief append a chunk of the output
+     *
+     * @return false once the output is known to differ, whatever follows
+     */
+    bool feed(const char *buf, size_t len);
+
+    /**
+     * @brief verdict once the whole output is fed, see Comparator::compare
+     */
+    nlohmann::json finish();
+};
+
+}  // namespace yamc
+
+#endif  // COMPARE_H_
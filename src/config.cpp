@@ -30,8 +30,28 @@ static const int OPTION_KEY_RWBIND = 'B';
 static const int OPTION_KEY_ROBIND = 'R';
 static const int OPTION_KEY_SYMLNK = 's';
 static const int OPTION_KEY_TMPFS = 3800;
+static const int OPTION_KEY_WORKSPACE = 6400;
+static const int OPTION_KEY_PROFILE_DIR = 6500;
+static const int OPTION_KEY_PROFILE = 6600;
 
-static const int OPTION_GRP_HELP = 3;
+static const int OPTION_GRP_MODE = 3;
+static const int OPTION_KEY_DAEMON = 5000;
+static const int OPTION_KEY_BATCH = 5100;
+static const int OPTION_KEY_POOL = 5200;
+static const int OPTION_KEY_FORKSRV = 5300;
+static const int OPTION_KEY_ZYGOTE = 5400;
+static const int OPTION_KEY_CDS = 5500;
+static const int OPTION_KEY_MEMFD = 5600;
+static const int OPTION_KEY_COMPILE_CACHE = 5700;
+static const int OPTION_KEY_COMPILE_CACHE_SIZE = 5800;
+static const int OPTION_KEY_PCH = 5900;
+static const int OPTION_KEY_PIPELINE = 6000;
+static const int OPTION_KEY_STRESS = 6100;
+static const int OPTION_KEY_USERNS = 6200;
+static const int OPTION_KEY_NETNS_POOL = 6300;
+static const int OPTION_KEY_ZYGOTE_PYTHON = 6700;
+
+static const int OPTION_GRP_HELP = 4;
 static const int OPTION_KEY_DEFT = 4000;
 
 static argp_option options[]{
@@ -80,16 +100,80 @@ static argp_option options[]{
      "additional mount tmpfs at dest with option. can be specified multiple "
      "times",
      OPTION_GRP_CONTAINER},
+    {"workspace", OPTION_KEY_WORKSPACE, "src:dest[:option]", 0,
+     "overlay src at dest, writable but discarded after every run. option is "
+     "that of the tmpfs holding the changes. can be specified multiple times",
+     OPTION_GRP_CONTAINER},
+    {"profile-dir", OPTION_KEY_PROFILE_DIR, "dir", 0,
+     "directory of profiles, see --profile", OPTION_GRP_CONTAINER},
+    {"profile", OPTION_KEY_PROFILE, "name", 0,
+     "use the rootfs assembled from the host paths listed in "
+     "<profile-dir>/name.json instead of the default robind",
+     OPTION_GRP_CONTAINER},
+    {"userns", OPTION_KEY_USERNS, "file", 0,
+     "keep the user namespace alive after exiting, recorded in file, and join "
+     "it instead of mapping ids again if it is recorded by an earlier run",
+     OPTION_GRP_CONTAINER},
+    {"daemon", OPTION_KEY_DAEMON, "socket", 0,
+     "serve jobs on a unix socket instead of running a program",
+     OPTION_GRP_MODE},
+    {"batch", OPTION_KEY_BATCH, "file", 0,
+     "run jobs listed in file, one json per line. `-` for stdin",
+     OPTION_GRP_MODE},
+    {"pool", OPTION_KEY_POOL, "n", 0,
+     "keep n prepared jails waiting for connections in daemon mode",
+     OPTION_GRP_MODE},
+    {"fork-server", OPTION_KEY_FORKSRV, "lib", 0,
+     "run dynamically linked programs through a fork server, which is "
+     "preloaded with lib and forks a copy of the program per execution",
+     OPTION_GRP_MODE},
+    {"zygote", OPTION_KEY_ZYGOTE, "script", 0,
+     "run `python script.py` forked off a python interpreter running script, "
+     "which has common modules imported",
+     OPTION_GRP_MODE},
+    {"zygote-python", OPTION_KEY_ZYGOTE_PYTHON, "python", 0,
+     "interpreter the zygote runs scripts for, python3 by default. programs "
+     "that are not it are exec'd as usual",
+     OPTION_GRP_MODE},
+    {"cds-cache", OPTION_KEY_CDS, "dir", 0,
+     "start java programs from class data sharing archives kept in dir",
+     OPTION_GRP_MODE},
+    {"memfd", OPTION_KEY_MEMFD, 0, 0,
+     "load the program from the host into a sealed memfd and fexecve it, so "
+     "that it needs not be mounted. only elf executables are supported",
+     OPTION_GRP_MODE},
+    {"compile-cache", OPTION_KEY_COMPILE_CACHE, "dir", 0,
+     "keep artifacts of jobs with a `cache` field in dir, keyed by the hash "
+     "of compiler, flags and sources",
+     OPTION_GRP_MODE},
+    {"compile-cache-size", OPTION_KEY_COMPILE_CACHE_SIZE, "bytes", 0,
+     "evict least recently used artifacts beyond this size", OPTION_GRP_MODE},
+    {"pch-cache", OPTION_KEY_PCH, "dir", 0,
+     "let g++ use a precompiled <bits/stdc++.h> kept in dir, built once for "
+     "every compiler and set of flags",
+     OPTION_GRP_MODE},
+    {"pipeline", OPTION_KEY_PIPELINE, "file", 0,
+     "compile, run and check a submission described in file. `-` for stdin",
+     OPTION_GRP_MODE},
+    {"stress", OPTION_KEY_STRESS, "file", 0,
+     "compare a program with a brute force one on generated inputs until "
+     "they differ, as described in file. `-` for stdin",
+     OPTION_GRP_MODE},
+    {"netns-pool", OPTION_KEY_NETNS_POOL, "n", 0,
+     "keep n empty network namespaces for jails to enter, reused once the "
+     "jail is destroyed if its program did not run as root",
+     OPTION_GRP_MODE},
     {"default", OPTION_KEY_DEFT, 0, 0, "check default value", OPTION_GRP_HELP},
     {0, 0, 0, 0, 0, 0},
 };
 
 static const char long_help[] =
     "example: yamc -- echo 233\vuse `yamc --default` to check some default "
-    "value";
+    "value. use `yamc --daemon <socket>` or `yamc --batch <file>` to run "
+    "jobs described in json, `yamc --pipeline <file>` to judge a submission";
 
 static std::string key2str(int key) {
-    if (key > 4000) return "";
+    if (key > 6700) return "";
     switch (key) {
         case OPTION_KEY_CHDIR:
             return "CHDIR";
@@ -148,6 +232,60 @@ static std::string key2str(int key) {
         case OPTION_KEY_TMPFS:
             return "TMPFS";
             break;
+        case OPTION_KEY_WORKSPACE:
+            return "WORKSPACE";
+            break;
+        case OPTION_KEY_PROFILE_DIR:
+            return "PROFILE_DIR";
+            break;
+        case OPTION_KEY_PROFILE:
+            return "PROFILE";
+            break;
+        case OPTION_KEY_DAEMON:
+            return "DAEMON";
+            break;
+        case OPTION_KEY_BATCH:
+            return "BATCH";
+            break;
+        case OPTION_KEY_POOL:
+            return "POOL";
+            break;
+        case OPTION_KEY_FORKSRV:
+            return "FORKSRV";
+            break;
+        case OPTION_KEY_ZYGOTE:
+            return "ZYGOTE";
+            break;
+        case OPTION_KEY_ZYGOTE_PYTHON:
+            return "ZYGOTE_PYTHON";
+            break;
+        case OPTION_KEY_CDS:
+            return "CDS";
+            break;
+        case OPTION_KEY_MEMFD:
+            return "MEMFD";
+            break;
+        case OPTION_KEY_COMPILE_CACHE:
+            return "COMPILE_CACHE";
+            break;
+        case OPTION_KEY_COMPILE_CACHE_SIZE:
+            return "COMPILE_CACHE_SIZE";
+            break;
+        case OPTION_KEY_PCH:
+            return "PCH";
+            break;
+        case OPTION_KEY_PIPELINE:
+            return "PIPELINE";
+            break;
+        case OPTION_KEY_STRESS:
+            return "STRESS";
+            break;
+        case OPTION_KEY_USERNS:
+            return "USERNS";
+            break;
+        case OPTION_KEY_NETNS_POOL:
+            return "NETNS_POOL";
+            break;
         case OPTION_KEY_DEFT:
             return "DEFAULT";
             break;
@@ -314,6 +452,85 @@ static auto parser = [](int key, char *arg, argp_state *state) -> error_t {
             conf->rwbind.emplace_back("", dest, option,
                                       MountPt::MNT_TYPE::TMPFS);
             break;
+        case OPTION_KEY_WORKSPACE:
+            if (strnlen(arg, buf_sz) + 1 > buf_sz)
+                argp_failure(state, EXIT_FAILURE, errno, "option to long");
+            option[0] = '\0';
+            if (sscanf(arg, "%[^:]:%[^:]:%s", src, dest, option) < 2) {
+                return EINVAL;
+            }
+            conf->workspace.emplace_back(
+                fs::absolute(src), dest,
+                option[0] ? option : Config::default_workspace_option,
+                MountPt::MNT_TYPE::OVERLAY);
+            break;
+        case OPTION_KEY_PROFILE_DIR:
+            conf->profile_dir = fs::absolute(arg);
+            break;
+        case OPTION_KEY_PROFILE:
+            conf->profile = arg;
+            break;
+        case OPTION_KEY_DAEMON:
+            conf->daemon_socket = arg;
+            break;
+        case OPTION_KEY_BATCH:
+            conf->batch_file = arg;
+            break;
+        case OPTION_KEY_POOL:
+            ulval = strtoul(arg, nullptr, 10);
+            if (errno != 0)
+                argp_failure(state, EXIT_FAILURE, errno, "overflow");
+            conf->pool_size = ulval;
+            break;
+        case OPTION_KEY_FORKSRV:
+            conf->fork_server_lib = fs::absolute(arg);
+            conf->fork_server = true;
+            break;
+        case OPTION_KEY_ZYGOTE:
+            conf->zygote_script = fs::absolute(arg);
+            conf->zygote = true;
+            break;
+        case OPTION_KEY_ZYGOTE_PYTHON:
+            conf->zygote_python = arg;
+            break;
+        case OPTION_KEY_CDS:
+            conf->cds_cache = fs::absolute(arg);
+            conf->robind.emplace_back(conf->cds_cache, Config::cds_mount_point,
+                                      "", MountPt::MNT_TYPE::ROBIND);
+            break;
+        case OPTION_KEY_MEMFD:
+            conf->exec_memfd = true;
+            break;
+        case OPTION_KEY_COMPILE_CACHE:
+            conf->compile_cache = fs::absolute(arg);
+            break;
+        case OPTION_KEY_COMPILE_CACHE_SIZE:
+            ulval = strtoul(arg, nullptr, 10);
+            if (errno != 0)
+                argp_failure(state, EXIT_FAILURE, errno, "overflow");
+            if (ulval <= 0) return EINVAL;
+            conf->compile_cache_size = ulval;
+            break;
+        case OPTION_KEY_PCH:
+            conf->pch_cache = fs::absolute(arg);
+            conf->robind.emplace_back(conf->pch_cache, Config::pch_mount_point,
+                                      "", MountPt::MNT_TYPE::ROBIND);
+            break;
+        case OPTION_KEY_PIPELINE:
+            conf->pipeline_file = arg;
+            break;
+        case OPTION_KEY_STRESS:
+            conf->stress_file = arg;
+            break;
+        case OPTION_KEY_USERNS:
+            conf->userns_pin = fs::absolute(arg);
+            break;
+        case OPTION_KEY_NETNS_POOL:
+            ulval = strtoul(arg, nullptr, 10);
+            if (errno != 0)
+                argp_failure(state, EXIT_FAILURE, errno, "overflow");
+            conf->netns_pool = ulval;
+            break;
         case OPTION_KEY_DEFT:
             printDefaultValue();
             argp_usage(state);
@@ -348,6 +565,21 @@ static void fillDefaultValue(Config &conf) {
 }
 
 static bool checkConf(Config &conf) {
+    int modes = 0;
+    for (const auto *file :
+         {&conf.daemon_socket, &conf.batch_file, &conf.pipeline_file,
+          &conf.stress_file}) {
+        modes += !file->empty();
+    }
+    if (modes > 1) {
+        return false;
+    }
+    if (conf.pool_size != 0 && conf.daemon_socket.empty()) {
+        return false;
+    }
+    if (!conf.profile.empty() && conf.profile_dir.empty()) {
+        return false;
+    }
     if (conf.stdin_fd == conf.stdout_fd &&
         conf.stdout_fd != Config::NO_IO_REDIRECT) {
         return false;
@@ -367,7 +599,9 @@ Config parseOptions(int argc, char *argv[]) {
     int subArgIdx = 0;
     if (int err =
             argp_parse(&argp, argc, argv, ARGP_NO_ARGS, &subArgIdx, &conf);
-        err != 0 || subArgIdx >= argc) {
+        err != 0 || (subArgIdx >= argc && conf.daemon_socket.empty() &&
+                     conf.batch_file.empty() && conf.pipeline_file.empty() &&
+                     conf.stress_file.empty())) {
         argp_help(&argp, stdout, ARGP_HELP_USAGE, argv[0]);
         exit(0);
     }
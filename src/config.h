@@ -33,6 +33,11 @@ struct Config {
         {"", "/run", "mode=755,size=16777216", MountPt::MNT_TYPE::TMPFS},
         {"", "/tmp", "mode=777,size=16777216", MountPt::MNT_TYPE::TMPFS},
     };
+    inline static const fs::path cds_mount_point{"/.yamc/cds"};
+    inline static const fs::path pch_mount_point{"/.yamc/pch"};
+    inline static const fs::path workspace_mount_point{"/.yamc/ws"};
+    inline static const std::string default_workspace_option{
+        "size=16777216"};
     inline static const std::vector<std::string> default_env{
         "PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin:.",
     };
@@ -57,6 +62,10 @@ struct Config {
     mount_list_t robind = default_robind;
     mount_list_t tmpfs = default_tmpfs;
     symlink_list_t symlink = default_symlink;
+    mount_list_t workspace;  // overlays with a fresh upper layer every run
+    std::vector<fs::path> hidden;  // masked by empty read only mounts
+    fs::path profile_dir;    // profiles, see src/profile.h
+    std::string profile;     // profile whose rootfs replaces default robind
     std::vector<std::string> env = default_env;
 
     /*
@@ -69,6 +78,28 @@ struct Config {
     int stdin_fd = NO_IO_REDIRECT;   // redirect this fd to stdin
     int stdout_fd = NO_IO_REDIRECT;  // redirect stdout to this fd
     int stderr_fd = NO_IO_REDIRECT;  // redirect stderr to this fd
+    bool exec_memfd = false;  // fexecve cmdline[0] of the host from a memfd
+    int exec_fd = -1;         // the memfd, as received inside the jail
+
+    /*
+     * run mode
+     */
+    fs::path daemon_socket;  // serve jobs on this unix socket if not empty
+    fs::path batch_file;     // run jobs listed in this file if not empty
+    fs::path pipeline_file;  // judge the submission in this file if not empty
+    fs::path stress_file;    // stress test as described in this file
+    unsigned long pool_size = 0;  // prepared jails kept by the daemon
+    fs::path fork_server_lib;     // preloaded into programs by fork servers
+    bool fork_server = false;     // exec through a fork server if possible
+    fs::path zygote_script;       // python zygote, see src/preload/zygote.py
+    bool zygote = false;          // run python scripts forked off a zygote
+    std::string zygote_python = "python3";  // interpreter the zygote is for
+    fs::path cds_cache;           // class data sharing archives for java
+    fs::path compile_cache;       // store of compiled artifacts
+    unsigned long compile_cache_size = 1024UL * 1024 * 1024;  // bytes
+    fs::path pch_cache;           // precompiled headers for g++
+    fs::path userns_pin;          // user namespace kept across runs
+    unsigned long netns_pool = 0;  // empty network namespaces kept
 };
 
 Config parseOptions(int argc, char* argv[]);
@@ -0,0 +1,351 @@
+#include "daemon.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <set>
+
+#include "jail.h"
+#include "job.h"
+#include "netns.h"
+#include "utils.h"
+
+namespace yamc {
+
+static volatile sig_atomic_t stopping = 0;
+
+// network namespaces lent to handlers, see netns.h
+static std::map<pid_t, int> lent_netns;
+
+static int listenOn(const fs::path &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.native().length() + 1 > sizeof(addr.sun_path)) {
+        throw std::runtime_error("socket path too long: " + path.string());
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    // remove the socket left by a previous daemon
+    if (fs::is_socket(path)) {
+        fs::remove(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) == -1 ||
+        chmod(path.c_str(), 0600) == -1 || listen(fd, SOMAXCONN) == -1) {
+        close(fd);
+        throw std::runtime_error("failed to listen on " + path.string() +
+                                 ": " + strerror(errno));
+    }
+    return fd;
+}
+
+static void setStopHandlers() {
+    struct sigaction sa {};
+    // no SA_RESTART, so that accept and poll are interrupted
+    sa.sa_handler = [](int) { stopping = 1; };
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGINT, &sa, nullptr) == -1 ||
+        sigaction(SIGTERM, &sa, nullptr) == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+}
+
+static void setSignalHandlers() {
+    setStopHandlers();
+    // connection handlers are reaped by the kernel
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static void resetSignalHandlers() {
+    // jails are waited for explicitly
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+}
+
+/**
+ * @brief fork a handler with a network namespace of the pool lent to it
+ */
+static pid_t forkHandler() {
+    int netns = takeNetns();
+    auto pid = fork();
+    if (pid == 0) {
+        for (const auto &lent : lent_netns) {
+            close(lent.second);
+        }
+        lent_netns.clear();
+        adoptNetns(netns);
+    } else if (pid == -1) {
+        giveNetns(netns, true);
+    } else if (netns != -1) {
+        lent_netns[pid] = netns;
+    }
+    return pid;
+}
+
+/**
+ * @brief take back the network namespace lent to a handler that exited. one
+ * that failed may have left its jail running in the namespace
+ */
+static void reclaimNetns(pid_t pid, int status, const Config &conf) {
+    auto it = lent_netns.find(pid);
+    if (it == lent_netns.end()) {
+        return;
+    }
+    giveNetns(it->second, WIFEXITED(status) &&
+                              WEXITSTATUS(status) == EXIT_SUCCESS &&
+                              conf.use_uid.inside_id != 0);
+    lent_netns.erase(it);
+}
+
+/**
+ * fork a handler for every connection
+ */
+static void serveForked(int listen_fd, const Config &conf) {
+    if (conf.netns_pool != 0) {
+        // handlers are reaped below to take their namespaces back
+        struct sigaction sa {};
+        sa.sa_handler = [](int) {};
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGCHLD, &sa, nullptr);
+    }
+    while (!stopping) {
+        pid_t pid;
+        int status;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            reclaimNetns(pid, status, conf);
+        }
+
+        int conn = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn == -1) {
+            if (errno != EINTR) {
+                LOG(ERROR) << "failed to accept: " << strerror(errno);
+            }
+            continue;
+        }
+
+        pid = forkHandler();
+        if (pid == 0) {
+            resetSignalHandlers();
+            close(listen_fd);
+            serveJobs(conn, conn, conf);
+            exit(EXIT_SUCCESS);
+        }
+        if (pid == -1) {
+            LOG(ERROR) << "failed to fork connection handler: "
+                       << strerror(errno);
+        }
+        close(conn);
+    }
+}
+
+/**
+ * @brief wait for a connection on listen_fd, which is non-blocking as it is
+ * shared by every idle worker. -1 once stop_fd is readable or closed
+ */
+static int acceptOrStop(int listen_fd, int stop_fd) {
+    while (!stopping) {
+        pollfd pfds[2] = {
+            {.fd = listen_fd, .events = POLLIN, .revents = 0},
+            {.fd = stop_fd, .events = POLLIN, .revents = 0},
+        };
+        if (poll(pfds, 2, -1) == -1) {
+            if (errno != EINTR) {
+                throw std::runtime_error(strerror(errno));
+            }
+            continue;
+        }
+        if (pfds[1].revents != 0) {
+            break;
+        }
+        int conn = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn != -1) {
+            return conn;
+        }
+        // taken by another worker
+        if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+            throw std::runtime_error(std::string("failed to accept: ") +
+                                     strerror(errno));
+        }
+    }
+    return -1;
+}
+
+/**
+ * a pool worker prepares its jail before waiting for a connection, so that
+ * the first job only costs a fork and exec. it tells the daemon through
+ * notify_fd once it takes a connection, then serves it and exits. an idle
+ * worker is stopped by the daemon closing the other end of stop_fd, or by
+ * SIGINT or SIGTERM, and tears its jail down before exiting
+ */
+static void poolWorker(int listen_fd, int notify_fd, int stop_fd,
+                       const Config &conf) {
+    resetSignalHandlers();
+    try {
+        auto jail = std::make_unique<Jail>(conf);
+        jail->waitReady();
+
+        // the jail process has been cloned with the default handlers
+        setStopHandlers();
+        int conn = acceptOrStop(listen_fd, stop_fd);
+        resetSignalHandlers();
+        close(stop_fd);
+        if (conn == -1) {
+            // exit does not unwind
+            jail.reset();
+            exit(EXIT_SUCCESS);
+        }
+
+        const pid_t pid = getpid();
+        if (!writeToFd(notify_fd, &pid, sizeof(pid))) {
+            LOG(ERROR) << "failed to notify daemon: " << strerror(errno);
+        }
+        close(listen_fd);
+        close(notify_fd);
+
+        serveJobs(conn, conn, conf, std::move(jail));
+    } catch (const std::exception &e) {
+        LOG(ERROR) << "pool worker failed: " << e.what();
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * keep conf.pool_size idle workers. workers that took a connection are
+ * replaced once no connection has come in for a while, or at once if the
+ * pool runs dry, so that refilling does not compete with the jobs just
+ * handed out
+ */
+static void servePool(int listen_fd, const Config &conf) {
+    using clock = std::chrono::steady_clock;
+    static const int quiet_ms = 50;
+    // before refilling again if workers can not prepare their jails at all
+    static const auto backoff = std::chrono::seconds(1);
+
+    int notify_fd[2], stop_fd[2];
+    if (pipe2(notify_fd, O_CLOEXEC) == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+    if (pipe2(stop_fd, O_CLOEXEC) == -1) {
+        close(notify_fd[0]);
+        close(notify_fd[1]);
+        throw std::runtime_error(strerror(errno));
+    }
+    int flags = fcntl(listen_fd, F_GETFL);
+    if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+    // workers are reaped below
+    signal(SIGCHLD, SIG_DFL);
+
+    std::set<pid_t> idle;
+    bool quiet = true;
+    auto refill_at = clock::now();
+    while (!stopping) {
+        const auto now = clock::now();
+        while (now >= refill_at && (quiet || idle.empty()) &&
+               idle.size() < conf.pool_size) {
+            auto pid = forkHandler();
+            if (pid == 0) {
+                close(notify_fd[0]);
+                close(stop_fd[1]);
+                poolWorker(listen_fd, notify_fd[1], stop_fd[0], conf);
+            }
+            if (pid == -1) {
+                LOG(ERROR) << "failed to fork pool worker: " << strerror(errno);
+                break;
+            }
+            idle.insert(pid);
+        }
+
+        pollfd pfd{.fd = notify_fd[0], .events = POLLIN, .revents = 0};
+        int timeout = idle.size() < conf.pool_size ? quiet_ms : 1000;
+        if (now < refill_at) {
+            const auto left = refill_at - now;
+            timeout = std::chrono::ceil<std::chrono::milliseconds>(left).count();
+        }
+        int ret = poll(&pfd, 1, timeout);
+        if (ret == -1 && errno != EINTR) {
+            throw std::runtime_error(strerror(errno));
+        }
+        quiet = ret == 0;
+        pid_t pid;
+        if (ret > 0 &&
+            readFromFd(notify_fd[0], &pid, sizeof(pid)) == sizeof(pid)) {
+            idle.erase(pid);
+        }
+
+        bool failed = false;
+        int status;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            reclaimNetns(pid, status, conf);
+            if (idle.erase(pid)) {
+                LOG(ERROR) << "pool worker " << pid
+                           << " exited before taking a connection";
+                failed = true;
+            }
+        }
+        if (failed) {
+            // do not spin if jails can not be prepared at all
+            refill_at = clock::now() + backoff;
+        }
+    }
+
+    // workers that took a connection are left to finish it
+    pollfd pfd{.fd = notify_fd[0], .events = POLLIN, .revents = 0};
+    pid_t pid;
+    while (poll(&pfd, 1, 0) > 0 &&
+           readFromFd(notify_fd[0], &pid, sizeof(pid)) == sizeof(pid)) {
+        idle.erase(pid);
+    }
+    close(notify_fd[0]);
+    close(notify_fd[1]);
+    close(stop_fd[1]);
+    for (auto pid : idle) {
+        int status;
+        if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) == pid) {
+            reclaimNetns(pid, status, conf);
+        }
+    }
+    close(stop_fd[0]);
+}
+
+void serveDaemon(const Config &conf) {
+    int listen_fd = listenOn(conf.daemon_socket);
+    setSignalHandlers();
+    LOG(INFO) << "listening on " << conf.daemon_socket;
+    // cloned by the jails of every handler
+    Jail::prepareRootfs(conf);
+
+    try {
+        if (conf.pool_size == 0) {
+            serveForked(listen_fd, conf);
+        } else {
+            servePool(listen_fd, conf);
+        }
+    } catch (const std::exception &e) {
+        LOG(ERROR) << "daemon failed: " << e.what();
+    }
+
+    LOG(INFO) << "shutting down";
+    close(listen_fd);
+    std::error_code ec;
+    fs::remove(conf.daemon_socket, ec);
+}
+
+}  // namespace yamc
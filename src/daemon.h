@@ -0,0 +1,21 @@
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#include "config.h"
+
+namespace yamc {
+
+/**
+ * @brief listen on conf.daemon_socket and serve jobs (see job.h) until
+ * SIGINT or SIGTERM. every connection is handled by a forked process that
+ * writes one json line back per job it receives
+ *
+ * with conf.pool_size > 0, that many handlers are forked ahead of time, each
+ * with its jail already prepared
+ *
+ */
+void serveDaemon(const Config &conf);
+
+}  // namespace yamc
+
+#endif  // DAEMON_H_
@@ -1,51 +1,291 @@
 #include "jail.h"
 
 #include <glog/logging.h>
+#include <elf.h>
+#include <fcntl.h>
 #include <glog/raw_logging.h>
 #include <grp.h>
+#include <linux/futex.h>
 #include <poll.h>
 #include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "memfd.h"
+#include "netns.h"
+#include "rootfs.h"
 #include "timer.h"
 #include "utils.h"
 
 namespace yamc {
 
-Jail::Jail(const Config &config) : conf_(config), jail_pid_(0), jailed_pid_(0) {
-    int sock_fd[2];
-    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sock_fd) == -1) {
-        RAW_LOG(ERROR, "failed to create socketpair");
+static const size_t max_msg_size = 64 * 1024;
+static const int jail_stack_size = 8 * 1024 * 1024;
+static const int killer_stack_size = 128 * 1024;
+static const char fork_server_lib_path[] = "/.yamc/libyamcfs.so";
+static const char zygote_script_path[] = "/.yamc/zygote.py";
+
+/**
+ * per execution part of config, sent to the jail along with the fds to be
+ * redirected and the memfd to be executed, in that order
+ */
+static std::string toExecSpec(const Config &conf, std::vector<int> &fds) {
+    nlohmann::json spec;
+    spec["cmdline"] = conf.cmdline;
+    spec["env"] = conf.env;
+    spec["chdir"] = conf.chdir_path.string();
+    spec["cpu"] = conf.cpu_time_limit.count();
+    spec["real"] = conf.real_time_limit.count();
+    spec["mem"] = conf.memory_limit;
+    spec["fsize"] = conf.output_limit;
+    spec["pid"] = conf.pid_limit;
+    spec["nfd"] = conf.openfile_limit;
+    spec["forkserver"] = conf.fork_server;
+    spec["zygote"] = conf.zygote;
+    spec["redirect"] = nlohmann::json::array();
+    for (auto fd : {conf.stdin_fd, conf.stdout_fd, conf.stderr_fd}) {
+        spec["redirect"].push_back(fd != Config::NO_IO_REDIRECT);
+        if (fd != Config::NO_IO_REDIRECT) {
+            fds.emplace_back(fd);
+        }
+    }
+    spec["memfd"] = conf.exec_memfd;
+    if (conf.exec_memfd) {
+        fds.emplace_back(loadMemfd(conf.cmdline.at(0)));
+    }
+    return spec.dump();
+}
+
+static void fromExecSpec(Config &conf, const std::string &payload,
+                         const std::vector<int> &fds) {
+    const auto spec = nlohmann::json::parse(payload);
+    conf.cmdline = spec.at("cmdline").get<std::vector<std::string>>();
+    conf.env = spec.at("env").get<std::vector<std::string>>();
+    conf.chdir_path = spec.at("chdir").get<std::string>();
+    conf.cpu_time_limit = std::chrono::seconds(spec.at("cpu").get<long>());
+    conf.real_time_limit = std::chrono::seconds(spec.at("real").get<long>());
+    conf.memory_limit = spec.at("mem").get<unsigned long>();
+    conf.output_limit = spec.at("fsize").get<unsigned long>();
+    conf.pid_limit = spec.at("pid").get<unsigned long>();
+    conf.openfile_limit = spec.at("nfd").get<unsigned long>();
+    conf.fork_server = spec.at("forkserver").get<bool>();
+    conf.zygote = spec.at("zygote").get<bool>();
+
+    int *redirects[] = {&conf.stdin_fd, &conf.stdout_fd, &conf.stderr_fd};
+    auto fd = fds.begin();
+    for (int i = 0; i < 3; ++i) {
+        *redirects[i] = Config::NO_IO_REDIRECT;
+        if (spec.at("redirect").at(i).get<bool>()) {
+            if (fd == fds.end()) {
+                throw std::runtime_error("missing fd to redirect");
+            }
+            *redirects[i] = *fd++;
+        }
+    }
+    conf.exec_memfd = spec.at("memfd").get<bool>();
+    conf.exec_fd = -1;
+    if (conf.exec_memfd) {
+        if (fd == fds.end()) {
+            throw std::runtime_error("missing fd to exec");
+        }
+        conf.exec_fd = *fd++;
+    }
+}
+
+static bool readElfHeader(const fs::path &path, Elf64_Ehdr &ehdr) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool is_elf = pread(fd, &ehdr, sizeof(ehdr), 0) == sizeof(ehdr) &&
+                  memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0 &&
+                  ehdr.e_ident[EI_CLASS] == ELFCLASS64;
+    close(fd);
+    return is_elf;
+}
+
+static bool hasInterp(const fs::path &path, const Elf64_Ehdr &ehdr) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool found = false;
+    Elf64_Phdr phdr;
+    for (int i = 0; i < ehdr.e_phnum && !found; ++i) {
+        if (pread(fd, &phdr, sizeof(phdr), ehdr.e_phoff + i * sizeof(phdr)) !=
+            sizeof(phdr)) {
+            break;
+        }
+        found = phdr.p_type == PT_INTERP;
+    }
+    close(fd);
+    return found;
+}
+
+/**
+ * @brief path of the program name as execvpe would search it in the jail,
+ * empty if not found
+ */
+static fs::path searchProgram(const Config &conf, const std::string &name) {
+    std::vector<fs::path> candidates;
+    if (name.find('/') != std::string::npos) {
+        candidates.emplace_back(name);
+    } else {
+        const char *path = getenv("PATH");
+        std::string dirs = path ? path : "/bin:/usr/bin";
+        size_t begin = 0, end;
+        do {
+            end = dirs.find(':', begin);
+            const auto dir = dirs.substr(begin, end - begin);
+            candidates.emplace_back(fs::path(dir.empty() ? "." : dir) / name);
+            begin = end + 1;
+        } while (end != std::string::npos);
+    }
+
+    for (const auto &candidate : candidates) {
+        const auto prog = conf.chdir_path / candidate;
+        if (access(prog.c_str(), X_OK) == 0) {
+            return prog;
+        }
+    }
+    return {};
+}
+
+/**
+ * the fork server library is only loaded into dynamically linked programs
+ * built for the same machine as itself. statically linked programs and
+ * scripts never reach the server loop and are exec'd as usual
+ */
+static bool canPreload(const Config &conf) {
+    Elf64_Ehdr lib, ehdr;
+    if (!readElfHeader(fork_server_lib_path, lib)) {
+        return false;
+    }
+    const auto prog = searchProgram(conf, conf.cmdline.at(0));
+    return !prog.empty() && readElfHeader(prog, ehdr) &&
+           ehdr.e_machine == lib.e_machine &&
+           ehdr.e_phentsize == sizeof(Elf64_Phdr) && hasInterp(prog, ehdr);
+}
+
+/**
+ * the zygote runs `interpreter script args...` for the interpreter it is
+ * configured with only, options to the interpreter are not supported
+ */
+static bool canZygote(const Config &conf) {
+    if (conf.cmdline.size() < 2 || conf.cmdline[1].rfind('-', 0) == 0 ||
+        !fs::exists(zygote_script_path)) {
+        return false;
+    }
+    const auto prog = searchProgram(conf, conf.cmdline[0]);
+    const auto python = searchProgram(conf, conf.zygote_python);
+    std::error_code ec;
+    return !prog.empty() && !python.empty() && fs::equivalent(prog, python, ec);
+}
+
+/**
+ * @brief wait until fd is readable, false on timeout
+ */
+static bool pollIn(int fd, std::chrono::seconds timeout) {
+    pollfd pfd{.fd = fd, .events = POLLIN, .revents = 0};
+    int ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, timeout.count() * 1000));
+    if (ret == -1) {
+        RAW_LOG(ERROR, "failed to call poll");
         throw std::runtime_error(strerror(errno));
     }
-    sock_inside_ = sock_fd[1];
-    sock_outside_ = sock_fd[0];
-    timer_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
-    oom_notifier_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
-    cgroup_.regOOMNotifier(oom_notifier_fd_);
+    return ret > 0;
+}
+
+static void drainEventfd(int fd) {
+    uint64_t val;
+    if (read(fd, &val, sizeof(val)) == -1 && errno != EAGAIN) {
+        throw std::runtime_error(strerror(errno));
+    }
+}
+
+Jail::Jail(const Config &config)
+    : conf_(config),
+      jail_pid_(0),
+      holder_pid_(0),
+      jailed_pid_(0),
+      sock_inside_(-1),
+      sock_outside_(-1),
+      sock_caller_(-1),
+      sock_supervisor_(-1),
+      timer_fd_(-1),
+      oom_notifier_fd_(-1),
+      stack_(nullptr),
+      killer_stack_(nullptr),
+      killer_tid_(0),
+      server_pid_(0),
+      sock_server_(-1),
+      ready_(false) {
+    netns_fd_ = takeNetns();
+    // the destructor does not run if this throws, so nothing may be kept
+    try {
+        rootfs_template_ = rootfsTemplate(conf_, extraBinds_(conf_));
+        int sock_fd[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sock_fd) ==
+            -1) {
+            RAW_LOG(ERROR, "failed to create socketpair");
+            throw std::runtime_error(strerror(errno));
+        }
+        sock_inside_ = sock_fd[1];
+        sock_outside_ = sock_fd[0];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sock_fd) ==
+            -1) {
+            RAW_LOG(ERROR, "failed to create socketpair");
+            throw std::runtime_error(strerror(errno));
+        }
+        sock_supervisor_ = sock_fd[1];
+        sock_caller_ = sock_fd[0];
+        timer_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        oom_notifier_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        cgroup_.regOOMNotifier(oom_notifier_fd_);
+        if (!extraBinds_(conf_).empty()) {
+            server_cgroup_ = std::make_unique<Cgroup>();
+            // the holder, a server and a child of it not yet moved to cgroup_
+            server_cgroup_->setMemoryLimit(conf_.memory_limit);
+            server_cgroup_->setPidLimit(conf_.pid_limit + 2);
+        }
+    } catch (...) {
+        for (auto fd : {sock_inside_, sock_outside_, sock_caller_,
+                        sock_supervisor_, timer_fd_, oom_notifier_fd_}) {
+            if (fd != -1) close(fd);
+        }
+        // nothing has run in it yet
+        giveNetns(netns_fd_, true);
+        throw;
+    }
 }
 
 int Jail::cloneWorkerProc_(void *_jail) {
     // jail process should run in new pid namespace. i.e. pid 1
     auto jail = static_cast<Jail *>(_jail);
     try {
-        jail->jailed_pid_ = fork();
-        if (jail->jailed_pid_ == -1) {
+        close(jail->sock_caller_);
+        jail->holder_pid_ = fork();
+        if (jail->holder_pid_ == -1) {
             throw std::runtime_error(strerror(errno));
         }
-        if (jail->jailed_pid_ == 0) {
-            // jailed proc
-            jail->inJailed_();
+        if (jail->holder_pid_ == 0) {
+            jail->holdJail_();
             // unreachable code
             exit(EXIT_FAILURE);
         }
-        RAW_DLOG(INFO, "see jailed proc as pid: %d", jail->jailed_pid_);
-        jail->waitJailed_();
+        // before the holder can start a server, whose code before main is
+        // as untrusted as the program
+        if (jail->server_cgroup_) {
+            jail->server_cgroup_->attach(jail->holder_pid_);
+        }
+        close(jail->sock_outside_);
+        if (jail->netns_fd_ != -1) close(jail->netns_fd_);
+        RAW_DLOG(INFO, "see holder proc as pid: %d", jail->holder_pid_);
+        jail->superviseJail_();
     } catch (const std::exception &e) {
         RAW_LOG(ERROR, "error in jail thread: %s", e.what());
         return EXIT_FAILURE;
@@ -54,52 +294,70 @@ int Jail::cloneWorkerProc_(void *_jail) {
     return EXIT_SUCCESS;
 }
 
-void Jail::pivotRoot_() {
-    try {
-        RAW_DLOG(INFO, "chrooting to %s...", conf_.chroot_path.c_str());
-        // see `man pivot_root.2`
-        if (mount("", conf_.chroot_path.c_str(), "tmpfs", 0, "size=16777216") ==
-            -1) {
-            RAW_LOG(ERROR, "failed to remount chroot %s",
-                    conf_.chroot_path.c_str());
-            throw std::runtime_error(strerror(errno));
-        }
+void Jail::superviseJail_() {
+    // READY or ERROR from the holder
+    auto stat = recvFrom_(SOCK::INSIDE);
+    sendTo_(SOCK::SUPERVISOR, stat);
+    if (stat != MESSAGE::READY) {
+        throw std::runtime_error("failed to prepare jail");
+    }
 
-        for (const auto &bind : conf_.robind) {
-            RAW_DLOG(INFO, "ro mounting %s -> %s", bind.src.c_str(),
-                     bind.dest.c_str());
-            mountFs(bind, conf_.chroot_path, MS_NOSUID);
-        }
-        for (const auto &bind : conf_.rwbind) {
-            const auto &target =
-                conf_.chroot_path / bind.dest.lexically_relative("/");
-            RAW_DLOG(INFO, "ro mounting %s -> %s", bind.src.c_str(),
-                     bind.dest.c_str());
-            mountFs(bind, conf_.chroot_path, MS_NOSUID);
-        }
-        for (const auto &bind : conf_.tmpfs) {
-            RAW_DLOG(INFO, "mounting tmpfs %s", bind.dest.c_str());
-            mountFs(bind, conf_.chroot_path, MS_NOSUID);
-        }
-        for (const auto &link : conf_.symlink) {
-            const auto target =
-                conf_.chroot_path / link.src.lexically_relative("/");
-            fs::create_symlink(link.dest, target);
+    std::string payload;
+    std::vector<int> fds;
+    while (recvFrom_(SOCK::SUPERVISOR, &payload, &fds) == MESSAGE::RUN) {
+        fromExecSpec(conf_, payload, fds);
+        sendTo_(SOCK::INSIDE, MESSAGE::RUN, payload, fds);
+        for (auto fd : fds) close(fd);
+        fds.clear();
+
+        Result result;
+        if (waitJailed_(result)) {
+            sendTo_(SOCK::SUPERVISOR, MESSAGE::DONE,
+                    std::string((const char *)&result, sizeof(result)));
+        } else {
+            sendTo_(SOCK::SUPERVISOR, MESSAGE::ERROR);
         }
+    }
+    RAW_DLOG(INFO, "caller hung up");
+}
 
-        const auto proc = conf_.chroot_path / "proc";
-        fs::create_directory(proc);
-        if (mount("", proc.c_str(), "proc", MS_NOSUID | MS_NOEXEC | MS_NODEV,
-                  "") == -1) {
-            RAW_DLOG(INFO, "failed to mount procfs");
-            throw std::runtime_error(strerror(errno));
+mount_list_t Jail::extraBinds_(const Config &conf) {
+    mount_list_t binds;
+    if (!conf.fork_server_lib.empty()) {
+        binds.emplace_back(conf.fork_server_lib, fork_server_lib_path, "",
+                           MountPt::MNT_TYPE::ROBIND);
+    }
+    if (!conf.zygote_script.empty()) {
+        binds.emplace_back(conf.zygote_script, zygote_script_path, "",
+                           MountPt::MNT_TYPE::ROBIND);
+    }
+    return binds;
+}
+
+void Jail::prepareRootfs(const Config &conf) {
+    rootfsTemplate(conf, extraBinds_(conf));
+}
+
+void Jail::pivotRoot_() {
+    try {
+        RAW_DLOG(INFO, "chrooting to %s...", conf_.chroot_path.c_str());
+        if (!rootfs_template_.empty()) {
+            cloneRootfs(rootfs_template_, conf_.chroot_path);
+        } else {
+            if (mount("", conf_.chroot_path.c_str(), "tmpfs", 0,
+                      "size=16777216") == -1) {
+                RAW_LOG(ERROR, "failed to remount chroot %s",
+                        conf_.chroot_path.c_str());
+                throw std::runtime_error(strerror(errno));
+            }
+            populateRootfs(conf_, extraBinds_(conf_), conf_.chroot_path);
         }
+        mountScratch(conf_, conf_.chroot_path);
 
-        auto putold = conf_.chroot_path / "putold";
-        fs::create_directory(putold);
-        if (pivot_root(conf_.chroot_path.c_str(), putold.c_str()) == -1 ||
-            chdir("/") == -1 || umount2("putold", MNT_DETACH) == -1 ||
-            !fs::remove("putold")) {
+        // see `man pivot_root.2`, the old root is stacked under the new one
+        if (chdir(conf_.chroot_path.c_str()) == -1 ||
+            pivot_root(".", ".") == -1 || umount2(".", MNT_DETACH) == -1 ||
+            chdir("/") == -1) {
             RAW_LOG(ERROR, "failed to pivot_root");
             throw std::runtime_error(strerror(errno));
         }
@@ -159,13 +417,24 @@ void Jail::changeCred_() {
     }
 }
 
-void Jail::inJailed_() {
-    RAW_DLOG(INFO, "jailed process started");
+void Jail::holdJail_() {
+    RAW_DLOG(INFO, "holder process started");
+    close(sock_inside_);
+    close(sock_supervisor_);
 
-    std::vector<const char *> arg_helper, env_helper;
     try {
-        if (unshare(CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWNET | CLONE_NEWIPC |
-                    CLONE_NEWCGROUP) == -1) {
+        int flags =
+            CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWCGROUP;
+        if (netns_fd_ == -1) {
+            flags |= CLONE_NEWNET;
+        } else {
+            if (setns(netns_fd_, CLONE_NEWNET) == -1) {
+                RAW_LOG(ERROR, "failed to enter network namespace");
+                throw std::runtime_error(strerror(errno));
+            }
+            close(netns_fd_);
+        }
+        if (unshare(flags) == -1) {
             RAW_LOG(ERROR, "failed to unshare some namespace");
             throw std::runtime_error(strerror(errno));
         }
@@ -178,8 +447,204 @@ void Jail::inJailed_() {
             throw std::runtime_error(strerror(errno));
         }
 
-        redirect_io_();
         pivotRoot_();
+        sendTo_(SOCK::OUTSIDE, MESSAGE::READY);
+    } catch (const std::exception &e) {
+        RAW_LOG(ERROR, "error in holder process: %s", e.what());
+        sendTo_(SOCK::OUTSIDE, MESSAGE::ERROR);
+        exit(EXIT_FAILURE);
+    }
+
+    try {
+        std::string payload;
+        std::vector<int> fds;
+        bool fresh = true;  // tmpfs untouched since pivotRoot_
+        while (recvFrom_(SOCK::OUTSIDE, &payload, &fds) == MESSAGE::RUN) {
+            fromExecSpec(conf_, payload, fds);
+            if (!fresh) {
+                remountScratch(conf_);
+            }
+            fresh = false;
+            if (conf_.exec_fd != -1) {
+                forkJailed_(fds);
+            } else if (!conf_.workspace.empty()) {
+                // servers would outlive the workspaces of a run
+                forkJailed_(fds);
+            } else if (conf_.zygote && canZygote(conf_)) {
+                serverExec_({conf_.cmdline[0], zygote_script_path}, conf_.env,
+                            payload, fds);
+            } else if (conf_.fork_server && canPreload(conf_)) {
+                auto env = conf_.env;
+                env.emplace_back(std::string("LD_PRELOAD=") +
+                                 fork_server_lib_path);
+                serverExec_(conf_.cmdline, env, payload, fds);
+            } else {
+                forkJailed_(fds);
+            }
+            fds.clear();
+        }
+    } catch (const std::exception &e) {
+        RAW_LOG(ERROR, "error in holder process: %s", e.what());
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+void Jail::forkJailed_(const std::vector<int> &fds) {
+    try {
+        mountWorkspaces(conf_);
+        jailed_pid_ = fork();
+    } catch (const std::exception &e) {
+        jailed_pid_ = -1;
+    }
+    if (jailed_pid_ == 0) {
+        inJailed_();
+        // unreachable code
+        exit(EXIT_FAILURE);
+    }
+    for (auto fd : fds) close(fd);
+
+    int status;
+    if (jailed_pid_ == -1) {
+        RAW_LOG(ERROR, "failed to fork jailed process");
+        sendTo_(SOCK::OUTSIDE, MESSAGE::ERROR);
+        status = W_EXITCODE(EXIT_FAILURE, 0);
+    } else if (waitpid(jailed_pid_, &status, 0) == -1) {
+        RAW_LOG(ERROR, "failed to waitpid for jailed process");
+        throw std::runtime_error(strerror(errno));
+    }
+    dropWorkspaces(conf_);
+    sendTo_(SOCK::OUTSIDE, MESSAGE::EXITED,
+            std::string((const char *)&status, sizeof(status)));
+}
+
+void Jail::serverExec_(const std::vector<std::string> &cmdline,
+                       const std::vector<std::string> &env,
+                       const std::string &spec, const std::vector<int> &fds) {
+    const auto key =
+        nlohmann::json{cmdline, env, conf_.chdir_path.string()}.dump();
+    if (server_pid_ != 0 && waitpid(server_pid_, nullptr, WNOHANG) != 0) {
+        // killed by a previous jailed process
+        server_pid_ = 0;
+        stopServer_();
+    }
+    if (server_pid_ != 0 && server_key_ != key) {
+        stopServer_();
+    }
+    if (server_pid_ == 0) {
+        startServer_(cmdline, env);
+        server_key_ = key;
+    }
+
+    yamc_server_request req{};
+    req.cpu_time_limit = conf_.cpu_time_limit.count();
+    req.output_limit = conf_.output_limit;
+    req.openfile_limit = conf_.openfile_limit;
+    req.redirect[0] = conf_.stdin_fd != Config::NO_IO_REDIRECT;
+    req.redirect[1] = conf_.stdout_fd != Config::NO_IO_REDIRECT;
+    req.redirect[2] = conf_.stderr_fd != Config::NO_IO_REDIRECT;
+    sendTo_(SOCK::SERVER, MESSAGE::RUN,
+            std::string((const char *)&req, sizeof(req)) + spec, fds);
+    for (auto fd : fds) close(fd);
+
+    std::string payload;
+    bool started = false;
+    for (;;) {
+        // once started, the killer of the jail process kills a server that
+        // hangs. before that, e.g. in code it runs before main, it is ours
+        auto stat = started || pollIn(sock_server_, conf_.real_time_limit)
+                        ? recvFrom_(SOCK::SERVER, &payload)
+                        : MESSAGE::CLOSED;
+        if (stat == MESSAGE::CLOSED) {
+            // e.g. the program failed to exec, or killed the server
+            int status = W_EXITCODE(EXIT_FAILURE, 0);
+            kill(server_pid_, SIGKILL);
+            waitpid(server_pid_, &status, 0);
+            server_pid_ = 0;
+            stopServer_();
+            RAW_LOG(ERROR, "exec server exited unexpectedly");
+            sendTo_(SOCK::OUTSIDE, MESSAGE::ERROR);
+            sendTo_(SOCK::OUTSIDE, MESSAGE::EXITED,
+                    std::string((const char *)&status, sizeof(status)));
+            return;
+        }
+        sendTo_(SOCK::OUTSIDE, stat, payload);
+        if (stat == MESSAGE::EXITED) {
+            return;
+        }
+        if (stat == MESSAGE::READY) {
+            recvFrom_(SOCK::OUTSIDE);  // should be MESSAGE::RUN
+            sendTo_(SOCK::SERVER, MESSAGE::RUN);
+            started = true;
+        }
+    }
+}
+
+void Jail::startServer_(const std::vector<std::string> &cmdline,
+                        const std::vector<std::string> &env) {
+    int sock_fd[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sock_fd) == -1) {
+        RAW_LOG(ERROR, "failed to create socketpair");
+        throw std::runtime_error(strerror(errno));
+    }
+    server_pid_ = fork();
+    if (server_pid_ == -1) {
+        server_pid_ = 0;
+        close(sock_fd[0]);
+        close(sock_fd[1]);
+        RAW_LOG(ERROR, "failed to fork exec server");
+        throw std::runtime_error(strerror(errno));
+    }
+    if (server_pid_ == 0) {
+        try {
+            // the server end has to survive exec
+            if (fcntl(sock_fd[1], F_SETFD, 0) == -1) {
+                throw std::runtime_error(strerror(errno));
+            }
+            changeCred_();
+            if (chdir(conf_.chdir_path.c_str()) == -1) {
+                RAW_LOG(ERROR, "failed to chdir to %s",
+                        conf_.chdir_path.c_str());
+                throw std::runtime_error(strerror(errno));
+            }
+
+            auto server_env = env;
+            server_env.emplace_back(std::string(YAMC_SERVER_FD_ENV "=") +
+                                    std::to_string(sock_fd[1]));
+            auto arg_helper = strvec2cstr(cmdline);
+            auto env_helper = strvec2cstr(server_env);
+            RAW_DLOG(INFO, "starting exec server %s", arg_helper[0]);
+            execvpe(arg_helper[0], (char *const *)arg_helper.data(),
+                    (char *const *)env_helper.data());
+            throw std::runtime_error(strerror(errno));
+        } catch (const std::exception &e) {
+            RAW_LOG(ERROR, "failed to start exec server: %s", e.what());
+        }
+        exit(EXIT_FAILURE);
+    }
+    close(sock_fd[1]);
+    sock_server_ = sock_fd[0];
+}
+
+void Jail::stopServer_() {
+    if (sock_server_ != -1) {
+        close(sock_server_);
+        sock_server_ = -1;
+    }
+    if (server_pid_ != 0) {
+        kill(server_pid_, SIGKILL);
+        waitpid(server_pid_, nullptr, 0);
+        server_pid_ = 0;
+    }
+    server_key_.clear();
+}
+
+void Jail::inJailed_() {
+    RAW_DLOG(INFO, "jailed process started");
+
+    std::vector<const char *> arg_helper, env_helper;
+    try {
+        redirect_io_();
         setrlimits_();
         changeCred_();
 
@@ -190,12 +655,20 @@ void Jail::inJailed_() {
 
         arg_helper = strvec2cstr(conf_.cmdline);
         env_helper = strvec2cstr(conf_.env);
-        sendTo_(SOCK::OUTSIDE, MESSAGE::READY);
+        pid_t pid = getpid();
+        sendTo_(SOCK::OUTSIDE, MESSAGE::READY,
+                std::string((const char *)&pid, sizeof(pid)));
         recvFrom_(SOCK::OUTSIDE);  // should be MESSAGE::RUN
 
-        RAW_DLOG(INFO, "execving %s", arg_helper[0]);
-        execvpe(arg_helper[0], (char *const *)arg_helper.data(),
-                (char *const *)env_helper.data());
+        if (conf_.exec_fd != -1) {
+            RAW_DLOG(INFO, "fexecving %s", arg_helper[0]);
+            fexecve(conf_.exec_fd, (char *const *)arg_helper.data(),
+                    (char *const *)env_helper.data());
+        } else {
+            RAW_DLOG(INFO, "execving %s", arg_helper[0]);
+            execvpe(arg_helper[0], (char *const *)arg_helper.data(),
+                    (char *const *)env_helper.data());
+        }
 
         RAW_LOG(ERROR, "failed to call execv: %s", strerror(errno));
         throw std::runtime_error(strerror(errno));
@@ -206,33 +679,37 @@ void Jail::inJailed_() {
     }
 }
 
-void Jail::waitJailed_() {
+bool Jail::waitJailed_(Result &result) {
     Timer timer;  // real-time timer
+    std::string payload;
+    if (recvFrom_(SOCK::INSIDE, &payload) != MESSAGE::READY) {
+        waitExited_();
+        return false;
+    }
+    if (payload.size() != sizeof(pid_t)) {
+        throw std::runtime_error("unexpected message from jailed process");
+    }
+    memcpy(&jailed_pid_, payload.data(), sizeof(pid_t));
+    RAW_DLOG(INFO, "see jailed proc as pid: %d", jailed_pid_);
+
     cgroup_.attach(jailed_pid_);
     cgroup_.setMemoryLimit(conf_.memory_limit);
     cgroup_.setPidLimit(conf_.pid_limit);
 
-    if (recvFrom_(SOCK::INSIDE) == MESSAGE::ERROR) {
-        return;
-    }
-
     timer.reset();
     cgroup_.resetTimer();
+    cgroup_.resetMemoryUsage();
     startKiller_();
     sendTo_(SOCK::INSIDE, MESSAGE::RUN);
     RAW_DLOG(INFO, "waiting for jailed process");
 
-    int status;
-    if (waitpid(jailed_pid_, &status, 0) == -1) {
-        RAW_LOG(ERROR, "failed to waitpid for jailed thread");
-        throw std::runtime_error(strerror(errno));
-    }
+    int status = waitExited_();
     RAW_DLOG(INFO, "jailed process exited");
 
     stopKiller_();
 
     RAW_DLOG(INFO, "starting to gather infomation");
-    Result result;
+    result = Result{};
     result.time.real = timer.tok();
     result.time.sys = cgroup_.getTimeSysUsage();
     result.time.usr = cgroup_.getTimeUsrUsage();
@@ -246,9 +723,37 @@ void Jail::waitJailed_() {
         throw std::runtime_error("jailed process exited for unknown reason");
     }
 
-    const auto &s = result.to_json().dump();
-    writeToFd(STDOUT_FILENO, s.c_str(), s.length());
-    return;
+    // processes left behind must not survive into the next execution
+    cgroup_.killAll();
+    reapOrphans_();
+    // nor the page cache they are charged for
+    cgroup_.reclaimMemory();
+    return true;
+}
+
+int Jail::waitExited_() {
+    std::string payload;
+    auto stat = recvFrom_(SOCK::INSIDE, &payload);
+    // jailed process that failed to exec reports an error before it exits
+    while (stat == MESSAGE::ERROR) {
+        stat = recvFrom_(SOCK::INSIDE, &payload);
+    }
+    if (stat != MESSAGE::EXITED || payload.size() != sizeof(int)) {
+        throw std::runtime_error("holder exited unexpectedly");
+    }
+    int status;
+    memcpy(&status, payload.data(), sizeof(int));
+    return status;
+}
+
+void Jail::reapOrphans_() {
+    // orphans are reparented to us, the init of the pid namespace
+    pid_t pid;
+    while ((pid = waitpid(-1, nullptr, WNOHANG | __WALL)) > 0) {
+        if (pid == holder_pid_) {
+            throw std::runtime_error("holder exited unexpectedly");
+        }
+    }
 }
 
 void Jail::setrlimits_() {
@@ -285,7 +790,6 @@ bool Jail::supervise_() {
 }
 
 void Jail::startKiller_() {
-    static const int stack_size = 128 * 1024;
 
     // _supervisor shoule be a thread of pid 1
     static const auto _supervisor = [](void *_jail) -> int {
@@ -307,18 +811,22 @@ void Jail::startKiller_() {
         return EXIT_SUCCESS;
     };
 
-    uint8_t *stack =
-        (uint8_t *)mmap(nullptr, stack_size, PROT_WRITE | PROT_READ,
+    // an oom event of the last execution should not kill this one
+    drainEventfd(oom_notifier_fd_);
+
+    killer_stack_ =
+        (uint8_t *)mmap(nullptr, killer_stack_size, PROT_WRITE | PROT_READ,
                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
-    if (stack == nullptr) {
+    if (killer_stack_ == MAP_FAILED) {
         RAW_LOG(ERROR, "failed to call mmap");
         throw std::runtime_error(strerror(errno));
     }
 
-    // _supervisor is detached. see man clone.2
-    if (clone(_supervisor, stack + stack_size,
-              CLONE_VM | CLONE_SIGHAND | CLONE_THREAD | CLONE_FILES,
-              this) == -1) {
+    // killer_tid_ is cleared by the kernel when _supervisor exits
+    if (clone(_supervisor, killer_stack_ + killer_stack_size,
+              CLONE_VM | CLONE_SIGHAND | CLONE_THREAD | CLONE_FILES |
+                  CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID,
+              this, &killer_tid_, nullptr, &killer_tid_) == -1) {
         RAW_LOG(ERROR, "filed to call clone");
         throw std::runtime_error(strerror(errno));
     }
@@ -332,11 +840,13 @@ void Jail::stopKiller_() {
         throw std::runtime_error(strerror(errno));
     }
 
-    int status = 0;
-    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
-        RAW_LOG(ERROR, "killer failed to kill jailed. terminating...");
-        exit(EXIT_FAILURE);
+    // join the killer so that it can not outlive this execution
+    for (pid_t tid; (tid = __atomic_load_n(&killer_tid_, __ATOMIC_ACQUIRE));) {
+        syscall(SYS_futex, &killer_tid_, FUTEX_WAIT, tid, nullptr, nullptr, 0);
     }
+    munmap(killer_stack_, killer_stack_size);
+    killer_stack_ = nullptr;
+    drainEventfd(timer_fd_);
     return;
 }
 
@@ -347,27 +857,102 @@ bool Jail::killChild() {
         RAW_LOG(ERROR, "failed to kill jailed process: %s", strerror(errno));
         return false;
     }
+    // a server stopped by the jailed process would never report its exit.
+    // the holder sees the server gone instead
+    if (server_cgroup_ && !server_cgroup_->killAllBut(holder_pid_)) {
+        RAW_LOG(ERROR, "failed to kill exec servers");
+        return false;
+    }
     return true;
 }
 
-int Jail::run() {
-    static const int stack_size = 8 * 1024 * 1024;
-    uint8_t *stack =
-        (uint8_t *)mmap(nullptr, stack_size, PROT_WRITE | PROT_READ,
-                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
-    if (stack == nullptr) {
+void Jail::killJailed() {
+    // the cgroup is only used by jailed processes, holders are not in it
+    cgroup_.killAll();
+}
+
+void Jail::prepare() {
+    if (jail_pid_ != 0) {
+        return;
+    }
+    if (sock_caller_ == -1) {
+        throw std::runtime_error("jail has been torn down");
+    }
+
+    stack_ = (uint8_t *)mmap(nullptr, jail_stack_size, PROT_WRITE | PROT_READ,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack_ == MAP_FAILED) {
         throw std::runtime_error(std::string("failed to call mmap: ") +
                                  strerror(errno));
     }
 
-    jail_pid_ = clone(cloneWorkerProc_, stack + stack_size, CLONE_NEWPID, this);
+    jail_pid_ =
+        clone(cloneWorkerProc_, stack_ + jail_stack_size, CLONE_NEWPID, this);
     if (jail_pid_ == -1) {
+        jail_pid_ = 0;
         throw std::runtime_error(std::string("failed to call fork: ") +
                                  strerror(errno));
     }
 
+    // so that we see EOF if the jail process dies
+    for (auto fd : {&sock_inside_, &sock_outside_, &sock_supervisor_}) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+void Jail::waitReady() {
+    prepare();
+    if (!ready_) {
+        if (recvFrom_(SOCK::CALLER) != MESSAGE::READY) {
+            throw std::runtime_error("failed to prepare jail");
+        }
+        ready_ = true;
+    }
+}
+
+void Jail::start(const Config &conf) {
+    waitReady();
+    std::vector<int> fds;
+    const auto &spec = toExecSpec(conf, fds);
+    sendTo_(SOCK::CALLER, MESSAGE::RUN, spec, fds);
+}
+
+Result Jail::wait() {
+    std::string payload;
+    switch (recvFrom_(SOCK::CALLER, &payload)) {
+        case MESSAGE::DONE:
+            if (payload.size() != sizeof(Result)) {
+                throw std::runtime_error("unexpected message from jail");
+            }
+            memcpy(&result_, payload.data(), sizeof(Result));
+            return result_;
+        case MESSAGE::ERROR:
+            throw std::runtime_error("failed to prepare jailed process");
+        default:
+            throw std::runtime_error("jail process exited unexceptedly");
+    }
+}
+
+Result Jail::exec(const Config &conf) {
+    start(conf);
+    return wait();
+}
+
+void Jail::teardown() {
+    if (sock_caller_ != -1) {
+        close(sock_caller_);
+        sock_caller_ = -1;
+    }
+    if (jail_pid_ == 0) {
+        return;
+    }
+
     int status;
-    if (waitpid(jail_pid_, &status, __WALL) == -1) {
+    auto pid = waitpid(jail_pid_, &status, __WALL);
+    munmap(stack_, jail_stack_size);
+    jail_pid_ = 0;
+    if (pid == -1) {
         RAW_LOG(ERROR, "failed to waitpid for jail thread");
         throw std::runtime_error(strerror(errno));
     }
@@ -379,33 +964,135 @@ int Jail::run() {
         throw std::runtime_error("exited unexceptedly");
     }
     RAW_DLOG(INFO, "jail thread exited");
+}
 
-    return WEXITSTATUS(status);
+int Jail::run() {
+    int ret = EXIT_SUCCESS;
+    try {
+        exec(conf_);
+    } catch (const std::exception &e) {
+        RAW_LOG(ERROR, "failed to run jail: %s", e.what());
+        ret = EXIT_FAILURE;
+    }
+    teardown();
+    return ret;
+}
+
+const Result &Jail::result() const { return result_; }
+
+int Jail::sockFd_(SOCK sock) const {
+    switch (sock) {
+        case SOCK::INSIDE:
+            return sock_inside_;
+        case SOCK::OUTSIDE:
+            return sock_outside_;
+        case SOCK::CALLER:
+            return sock_caller_;
+        case SOCK::SUPERVISOR:
+            return sock_supervisor_;
+        case SOCK::SERVER:
+            return sock_server_;
+    }
+    throw std::runtime_error("unknown socket");
 }
 
-void Jail::sendTo_(SOCK sock, MESSAGE stat) {
-    auto fd = sock == SOCK::INSIDE ? sock_inside_ : sock_outside_;
-    if (!writeToFd(fd, &stat, sizeof(MESSAGE))) {
+void Jail::sendTo_(SOCK sock, MESSAGE stat, const std::string &payload,
+                   const std::vector<int> &fds) {
+    auto fd = sockFd_(sock);
+    std::string msg((const char *)&stat, sizeof(MESSAGE));
+    msg += payload;
+    if (!sendMsg(fd, msg.data(), msg.size(), fds)) {
         RAW_LOG(ERROR, "failed to write to socket");
         throw std::runtime_error(strerror(errno));
     }
 }
 
-Jail::MESSAGE Jail::recvFrom_(SOCK sock) {
-    auto fd = sock == SOCK::INSIDE ? sock_inside_ : sock_outside_;
-    Jail::MESSAGE stat;
-    if (readFromFd(fd, &stat, sizeof(stat)) != sizeof(Jail::MESSAGE)) {
+Jail::MESSAGE Jail::recvFrom_(SOCK sock, std::string *payload,
+                              std::vector<int> *fds) {
+    auto fd = sockFd_(sock);
+    std::vector<char> buf(max_msg_size);
+    std::vector<int> received;
+    auto sz = recvMsg(fd, buf.data(), buf.size(), received);
+    // a peer killed with messages unread resets the connection
+    if (sz == 0 || (sz == -1 && errno == ECONNRESET)) {
+        return MESSAGE::CLOSED;
+    }
+    if (sz < static_cast<ssize_t>(sizeof(MESSAGE))) {
+        for (auto rfd : received) close(rfd);
         RAW_LOG(ERROR, "failed to read from socket");
-        throw std::runtime_error(strerror(errno));
+        throw std::runtime_error(sz == -1 ? strerror(errno)
+                                          : "message too short");
+    }
+
+    Jail::MESSAGE stat;
+    memcpy(&stat, buf.data(), sizeof(MESSAGE));
+    if (payload) {
+        payload->assign(buf.data() + sizeof(MESSAGE), sz - sizeof(MESSAGE));
+    }
+    if (fds) {
+        fds->insert(fds->end(), received.begin(), received.end());
+    } else {
+        for (auto rfd : received) close(rfd);
     }
     return stat;
 }
 
 Jail::~Jail() {
-    close(sock_inside_);
-    close(sock_outside_);
+    bool torn_down = false;
+    try {
+        teardown();
+        torn_down = true;
+    } catch (const std::exception &e) {
+        RAW_LOG(ERROR, "failed to tear down jail: %s", e.what());
+    }
+    for (auto fd : {sock_inside_, sock_outside_, sock_supervisor_}) {
+        if (fd != -1) close(fd);
+    }
     close(timer_fd_);
     close(oom_notifier_fd_);
+    // root in the jail could have changed the network namespace in ways that
+    // are not checked for
+    giveNetns(netns_fd_, torn_down && conf_.use_uid.inside_id != 0);
+}
+
+bool buildInJail(const Config &conf, const fs::path &staging_point,
+                 const std::string &output, const fs::path &dest) {
+    const auto staging =
+        dest.parent_path() /
+        ("." + dest.filename().string() + "." + std::to_string(getpid()));
+    fs::create_directory(staging);
+    // written by the program running as the jail user
+    if (chown(staging.c_str(), conf.use_uid.inside_id,
+              conf.use_gid.inside_id) == -1) {
+        fs::remove(staging);
+        throw std::runtime_error("failed to chown " + staging.string() + ": " +
+                                 strerror(errno));
+    }
+
+    Config build = conf;
+    build.rwbind.emplace_back(staging, staging_point, "",
+                              MountPt::MNT_TYPE::RWBIND);
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    build.stdin_fd = build.stdout_fd = build.stderr_fd = null_fd;
+    build.exec_memfd = false;
+
+    bool built = false;
+    try {
+        Jail jail{build};
+        jail.exec(build);
+        const auto file = staging / output;
+        std::error_code ec;
+        if (fs::is_regular_file(file, ec) && fs::file_size(file, ec) > 0) {
+            fs::rename(file, dest);
+            built = true;
+        }
+    } catch (const std::exception &e) {
+        RAW_LOG(WARNING, "failed to build %s: %s", dest.c_str(), e.what());
+    }
+    close(null_fd);
+    std::error_code ec;
+    fs::remove_all(staging, ec);
+    return built;
 }
 
 }  // namespace yamc
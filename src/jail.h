@@ -1,35 +1,118 @@
 #ifndef JAIL_H_
 #define JAIL_H_
 
+#include <memory>
+
 #include "cgroup.h"
 #include "config.h"
+#include "message.h"
 
 namespace yamc {
 
+/**
+ * a jail consists of
+ *  - the jail process, pid 1 of a new pid namespace. it supervises every
+ *    execution and reports the results to the caller
+ *  - the holder process, which owns the other namespaces and the pivoted
+ *    root. it is prepared once and forks a jailed process per execution
+ *  - jailed processes, which exec the program
+ *  - optionally an exec server, forked by the holder. it is started once
+ *    and forks a jailed process per execution, either right before main of
+ *    the program (src/preload/forksrv.c) or from a python interpreter with
+ *    modules imported (src/preload/zygote.py)
+ *
+ * run() does a single execution with the config the jail is created with.
+ * exec() can be called any number of times on the same jail, each time with
+ * a different cmdline, environment, io redirection and limits. namespaces,
+ * mounts, ids and the cgroup stay as configured on construction
+ */
 class Jail {
    private:
-    enum class MESSAGE { READY, RUN, ERROR };
-    enum class SOCK { INSIDE, OUTSIDE };
+    enum class MESSAGE : int32_t {
+        READY = YAMC_MSG_READY,
+        RUN = YAMC_MSG_RUN,
+        ERROR = YAMC_MSG_ERROR,
+        EXITED = YAMC_MSG_EXITED,
+        DONE = YAMC_MSG_DONE,
+        CLOSED = YAMC_MSG_CLOSED,
+    };
+    enum class SOCK { INSIDE, OUTSIDE, CALLER, SUPERVISOR, SERVER };
 
     Config conf_;
     Cgroup cgroup_;
-    pid_t jail_pid_, jailed_pid_;
+    // the holder and the exec servers it starts, if the jail may have any.
+    // jailed processes forked by a server are moved to cgroup_ once ready
+    std::unique_ptr<Cgroup> server_cgroup_;
+    pid_t jail_pid_, holder_pid_, jailed_pid_;
     int sock_inside_, sock_outside_;
+    int sock_caller_, sock_supervisor_;
     int timer_fd_, oom_notifier_fd_;
+    int netns_fd_;  // network namespace taken from the pool, -1 if none
+    fs::path rootfs_template_;  // cloned as root if not empty, see rootfs.h
+    uint8_t *stack_, *killer_stack_;
+    pid_t killer_tid_;
+    pid_t server_pid_;
+    int sock_server_;
+    std::string server_key_;  // cmdline, env and chdir the server runs with
+    bool ready_;
+    Result result_;
 
     static int cloneWorkerProc_(void *_jail);
     friend int cloneWorkerProc_(void *_jail);
 
     void setrlimits_();
 
+    void holdJail_();
+
     void inJailed_();
 
-    void waitJailed_();
+    /**
+     * @brief fork a jailed process and report its exit status. fds to be
+     * redirected are closed once forked
+     *
+     */
+    void forkJailed_(const std::vector<int> &fds);
+
+    /**
+     * @brief let the exec server started with cmdline and env fork a jailed
+     * process, starting the server first if there is none. messages of the
+     * jailed process are relayed to the jail process
+     *
+     */
+    void serverExec_(const std::vector<std::string> &cmdline,
+                     const std::vector<std::string> &env,
+                     const std::string &spec, const std::vector<int> &fds);
+
+    void startServer_(const std::vector<std::string> &cmdline,
+                      const std::vector<std::string> &env);
+
+    void stopServer_();
+
+    void superviseJail_();
+
+    /**
+     * @brief return false if the jailed process failed before exec
+     *
+     */
+    bool waitJailed_(Result &result);
+
+    /**
+     * @brief wait for the holder to report the exit status of the jailed
+     * process
+     *
+     */
+    int waitExited_();
+
+    void reapOrphans_();
 
     void startKiller_();
 
     void stopKiller_();
 
+    /**
+     * @brief binds of a jail configured by conf besides those configured
+     */
+    static mount_list_t extraBinds_(const Config &conf);
     void pivotRoot_();
 
     void redirect_io_();
@@ -42,27 +125,98 @@ class Jail {
      */
     bool supervise_();
 
-    void sendTo_(SOCK sock, MESSAGE stat);
+    int sockFd_(SOCK sock) const;
+
+    void sendTo_(SOCK sock, MESSAGE stat, const std::string &payload = "",
+                 const std::vector<int> &fds = {});
 
-    Jail::MESSAGE recvFrom_(SOCK sock);
+    Jail::MESSAGE recvFrom_(SOCK sock, std::string *payload = nullptr,
+                            std::vector<int> *fds = nullptr);
 
    public:
     Jail() = delete;
-    Jail(Jail const&) = delete;
-    Jail& operator=(Jail const&) = delete;
+    Jail(Jail const &) = delete;
+    Jail &operator=(Jail const &) = delete;
     explicit Jail(const Config &config);
 
+    /**
+     * @brief build the template the roots of jails configured by conf are
+     * cloned from ahead of time, so that processes forked off afterwards
+     * share it. see rootfs.h
+     */
+    static void prepareRootfs(const Config &conf);
+
+    /**
+     * @brief spawn the jail process. namespaces and root are prepared in the
+     * background. called by start() if not called before
+     *
+     */
+    void prepare();
+
+    /**
+     * @brief block until the jail is prepared and ready to exec
+     *
+     */
+    void waitReady();
 
+    /**
+     * @brief start an execution in the jail. cmdline, env, chdir, io
+     * redirection and limits are taken from conf
+     *
+     */
+    void start(const Config &conf);
+
+    /**
+     * @brief wait for the execution started by start()
+     *
+     */
+    Result wait();
+
+    Result exec(const Config &conf);
+
+    /**
+     * @brief stop the jail process. the jail can not be used afterwards
+     *
+     */
+    void teardown();
+
+    /**
+     * @brief kill the running jailed process, and exec servers along with it.
+     * only meaningful inside the jail process
+     *
+     */
     bool killChild();
 
+    /**
+     * @brief kill the execution started by start() along with every process
+     * it forked, from the caller. wait() then reports it killed by SIGKILL
+     *
+     */
+    void killJailed();
+
     /**
      * @brief return 0 for success or 1 for error
      */
     int run();
 
+    /**
+     * @brief result of the last successful execution
+     */
+    const Result &result() const;
+
     ~Jail();
 };
 
+/**
+ * @brief run conf once, with /dev/null as stdio, in a jail of its own that has
+ * a fresh directory bind mounted writable at staging_point. the file output
+ * left there by the program is then published atomically as dest
+ *
+ * @return false if the program failed to leave output behind
+ */
+bool buildInJail(const Config &conf, const fs::path &staging_point,
+                 const std::string &output, const fs::path &dest);
+
 }  // namespace yamc
 
 #endif  // JAIL_H_
\ No newline at end of file
@@ -0,0 +1,285 @@
+#include "job.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "artifact.h"
+#include "cds.h"
+#include "compare.h"
+#include "pch.h"
+#include "stream.h"
+#include "utils.h"
+
+namespace yamc {
+
+static unsigned long getLimit(const nlohmann::json &desc, const char *key,
+                              unsigned long min, unsigned long deft) {
+    if (!desc.contains(key)) return deft;
+    const auto &val = desc.at(key);
+    if (!val.is_number_unsigned() || val.get<unsigned long>() < min) {
+        throw std::runtime_error(std::string("invalid value of ") + key);
+    }
+    return val.get<unsigned long>();
+}
+
+Job::Job(const Config &base, const nlohmann::json &desc) : conf_(base) {
+    if (!desc.is_object() || !desc.contains("cmdline")) {
+        throw std::runtime_error("cmdline is required");
+    }
+    conf_.cmdline = desc.at("cmdline").get<std::vector<std::string>>();
+    if (conf_.cmdline.empty()) {
+        throw std::runtime_error("cmdline is empty");
+    }
+    if (desc.contains("env")) {
+        for (const auto &env : desc.at("env")) {
+            conf_.env.emplace_back(env.get<std::string>());
+        }
+    }
+    if (desc.contains("chdir")) {
+        conf_.chdir_path = desc.at("chdir").get<std::string>();
+    }
+    if (desc.contains("forkserver")) {
+        conf_.fork_server = desc.at("forkserver").get<bool>();
+    }
+    if (desc.contains("zygote")) {
+        conf_.zygote = desc.at("zygote").get<bool>();
+    }
+    if (desc.contains("memfd")) {
+        conf_.exec_memfd = desc.at("memfd").get<bool>();
+    }
+    if (desc.contains("cache")) {
+        const auto &cache = desc.at("cache");
+        for (const auto &source : cache.at("sources")) {
+            sources_.emplace_back(source.get<std::string>());
+        }
+        artifact_ = cache.at("artifact").get<std::string>();
+        if (artifact_.empty()) {
+            throw std::runtime_error("artifact is empty");
+        }
+    }
+
+    conf_.cpu_time_limit = std::chrono::seconds(
+        getLimit(desc, "cpu", 1, base.cpu_time_limit.count()));
+    conf_.real_time_limit = std::chrono::seconds(
+        getLimit(desc, "real", 1, base.real_time_limit.count()));
+    conf_.memory_limit = getLimit(desc, "mem", 1, base.memory_limit);
+    conf_.output_limit = getLimit(desc, "fsize", 1, base.output_limit);
+    conf_.pid_limit = getLimit(desc, "pid", 1, base.pid_limit);
+    conf_.openfile_limit = getLimit(desc, "nfd", 3, base.openfile_limit);
+    useCdsArchive(conf_);
+    usePrecompiledHeader(conf_);
+
+    try {
+        if (desc.contains("stdin")) {
+            conf_.stdin_fd = openFile_(desc.at("stdin"), false);
+        }
+        if (desc.contains("stdout")) {
+            conf_.stdout_fd = openFile_(desc.at("stdout"), true);
+        }
+        if (desc.contains("stderr")) {
+            conf_.stderr_fd = openFile_(desc.at("stderr"), true);
+        }
+        // stderr of a cached compilation is kept along with the artifact
+        if (!base.compile_cache.empty() && !artifact_.empty()) {
+            stderr_fd_ = conf_.stderr_fd == Config::NO_IO_REDIRECT
+                             ? STDERR_FILENO
+                             : conf_.stderr_fd;
+            captured_fd_ = memfd_create("yamc-stderr", MFD_CLOEXEC);
+            if (captured_fd_ == -1) {
+                throw std::runtime_error(
+                    std::string("failed to call memfd_create: ") +
+                    strerror(errno));
+            }
+            fds_.emplace_back(captured_fd_);
+            conf_.stderr_fd = captured_fd_;
+        }
+    } catch (const std::exception &e) {
+        for (auto fd : fds_) close(fd);
+        throw;
+    }
+}
+
+int Job::openFile_(const nlohmann::json &desc, bool output) {
+    const auto path = desc.get<std::string>();
+    // outputs may be in directories jails write, e.g. those of earlier jobs
+    if (output) {
+        int fd = openOutputFile(path);
+        fds_.emplace_back(fd);
+        return fd;
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error("failed to open " + path + ": " +
+                                 strerror(errno));
+    }
+    fds_.emplace_back(fd);
+    return fd;
+}
+
+const Config &Job::conf() const { return conf_; }
+
+const std::vector<fs::path> &Job::sources() const { return sources_; }
+
+const fs::path &Job::artifact() const { return artifact_; }
+
+int Job::stderrFd() const { return stderr_fd_; }
+
+fs::path Job::releaseStderr() {
+    static const size_t buf_sz = 4096;
+    char buf[buf_sz];
+    ssize_t sz;
+    for (off_t off = 0;
+         (sz = TEMP_FAILURE_RETRY(pread(captured_fd_, buf, buf_sz, off))) > 0;
+         off += sz) {
+        if (!writeToFd(stderr_fd_, buf, sz)) {
+            LOG(WARNING) << "failed to write stderr: " << strerror(errno);
+            break;
+        }
+    }
+    return fs::path("/proc/self/fd") / std::to_string(captured_fd_);
+}
+
+Job::~Job() {
+    for (auto fd : fds_) close(fd);
+}
+
+nlohmann::json runJob(std::unique_ptr<Jail> &jail, const Config &base,
+                      const nlohmann::json &desc) {
+    Job job{base, desc};
+
+    // stdout is compared with the answer once the job succeeds, or while it
+    // runs if streamed
+    std::unique_ptr<Comparator> comparator;
+    bool stream = false;
+    if (desc.contains("compare")) {
+        const auto &compare = desc.at("compare");
+        comparator = std::make_unique<Comparator>(compare);
+        stream = compare.value("stream", false);
+        if (!compare.contains("answer") ||
+            !(stream || desc.contains("stdout"))) {
+            throw std::runtime_error("compare requires stdout and answer");
+        }
+    }
+
+    std::string key;
+    fs::path artifact;
+    if (!base.compile_cache.empty() && !job.artifact().empty()) {
+        key = compileKey(job.conf(), job.sources());
+        artifact = hostPath(job.conf(), job.artifact());
+        if (artifact.empty()) {
+            throw std::runtime_error("artifact is not reachable from host");
+        }
+        ArtifactStore store{base.compile_cache, base.compile_cache_size};
+        if (store.fetch(key, artifact, job.stderrFd())) {
+            auto res = Result{}.to_json();
+            res["cached"] = true;
+            return res;
+        }
+    }
+
+    Result result;
+    std::unique_ptr<CapturedOutput> output;
+    try {
+        if (!jail) {
+            jail = std::make_unique<Jail>(base);
+        }
+        // stdout is captured to be streamed or hashed
+        if (stream || desc.contains("hash")) {
+            jail->prepare();
+            output = std::make_unique<CapturedOutput>(job.conf());
+            if (stream) {
+                output->compare(
+                    *comparator,
+                    desc.at("compare").at("answer").get<std::string>());
+            }
+            if (desc.contains("hash")) {
+                output->hash(desc.at("hash"));
+            }
+            jail->start(output->redirect(job.conf()));
+            output->pump(*jail);
+            result = jail->wait();
+        } else {
+            result = jail->exec(job.conf());
+        }
+    } catch (const std::exception &e) {
+        // start over with a new jail in case this one is broken
+        jail.reset();
+        throw;
+    }
+
+    auto res = result.to_json();
+    if (output) {
+        res.update(output->report(res));
+    }
+    if (comparator && !stream && result.return_code == 0 &&
+        result.signal == 0) {
+        try {
+            res["compare"] = comparator->compare(
+                desc.at("stdout").get<std::string>(),
+                desc.at("compare").at("answer").get<std::string>());
+        } catch (const std::exception &e) {
+            res["compare"] = {{"verdict", "fail"}, {"message", e.what()}};
+        }
+    }
+    if (!key.empty()) {
+        res["cached"] = false;
+        const auto err = job.releaseStderr();
+        if (result.return_code == 0 && result.signal == 0 &&
+            fs::is_regular_file(artifact)) {
+            try {
+                ArtifactStore{base.compile_cache, base.compile_cache_size}
+                    .publish(key, artifact, err);
+            } catch (const std::exception &e) {
+                LOG(WARNING) << "failed to cache artifact: " << e.what();
+            }
+        }
+    }
+    return res;
+}
+
+static nlohmann::json runLine(std::unique_ptr<Jail> &jail, const Config &base,
+                              const std::string &line) {
+    try {
+        return runJob(jail, base, nlohmann::json::parse(line));
+    } catch (const std::exception &e) {
+        LOG(ERROR) << "failed to run job: " << e.what();
+        return nlohmann::json{{"error", e.what()}};
+    }
+}
+
+void serveJobs(int in_fd, int out_fd, const Config &base,
+               std::unique_ptr<Jail> jail) {
+    static const size_t buf_sz = 4096;
+    char buf[buf_sz];
+    std::string pending;
+
+    for (;;) {
+        ssize_t sz = TEMP_FAILURE_RETRY(read(in_fd, buf, buf_sz));
+        if (sz < 0) {
+            LOG(ERROR) << "failed to read jobs: " << strerror(errno);
+            return;
+        }
+        if (sz == 0 && pending.empty()) return;
+        pending.append(buf, sz);
+        if (sz == 0) pending.push_back('\n');  // unterminated last line
+
+        size_t begin = 0, end;
+        while ((end = pending.find('\n', begin)) != std::string::npos) {
+            const auto line = pending.substr(begin, end - begin);
+            begin = end + 1;
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            const auto &s = dumpLine(runLine(jail, base, line));
+            if (!writeToFd(out_fd, s.c_str(), s.length())) {
+                LOG(ERROR) << "failed to write result: " << strerror(errno);
+                return;
+            }
+        }
+        pending.erase(0, begin);
+    }
+}
+
+}  // namespace yamc
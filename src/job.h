@@ -0,0 +1,96 @@
+#ifndef JOB_H_
+#define JOB_H_
+
+#include <memory>
+
+#include "config.h"
+#include "jail.h"
+
+namespace yamc {
+
+/**
+ * @brief a single execution described by a json object, e.g.
+ * {"cmdline": ["./a.out"], "stdin": "1.in", "stdout": "1.out", "cpu": 1}
+ *
+ * fields left out are taken from the base config. files named in the
+ * description are opened on construction and closed on destruction
+ *
+ * a compilation can be cached with
+ * "cache": {"sources": ["a.cpp"], "artifact": "a.out"}, paths as seen inside
+ * the jail. its stderr is cached as well, and replayed on a hit. see
+ * artifact.h
+ *
+ * stdout of a job can be compared with an answer by the built-in comparator,
+ * "compare": {"answer": "1.ans", "mode": "tokens"}. see compare.h. with
+ * "stream": true, stdout is compared while the job runs, and the job is
+ * killed at the first difference. see stream.h
+ *
+ * with "hash": {"mode": "tokens", "expect": "<xxh64>"}, stdout is hashed
+ * while it is produced instead, without reading the answer. it is only
+ * written to a file if "stdout" is given
+ */
+class Job {
+   private:
+    Config conf_;
+    std::vector<int> fds_;
+    std::vector<fs::path> sources_;  // inputs of a cached compilation
+    fs::path artifact_;              // its output, empty if not cached
+    int stderr_fd_ = -1;    // where its stderr goes in the end
+    int captured_fd_ = -1;  // memfd its stderr is captured in meanwhile
+
+    int openFile_(const nlohmann::json &desc, bool output);
+
+   public:
+    Job() = delete;
+    Job(Job const &) = delete;
+    Job &operator=(Job const &) = delete;
+    Job(const Config &base, const nlohmann::json &desc);
+
+    const Config &conf() const;
+
+    const std::vector<fs::path> &sources() const;
+
+    const fs::path &artifact() const;
+
+    /**
+     * @brief fd the stderr of a cached compilation finally goes to
+     *
+     */
+    int stderrFd() const;
+
+    /**
+     * @brief copy the stderr captured from a cached compilation to where it
+     * goes, and return a path it can still be read from
+     *
+     */
+    fs::path releaseStderr();
+
+    ~Job();
+};
+
+/**
+ * @brief run the job described by desc in jail, which is created from base
+ * if null and reset if broken by the job. jobs with a `cache` field go through
+ * the compile cache if there is one. verdicts of a job with a `compare` or
+ * `hash` field are added to the result under the same name if it succeeds
+ *
+ * @return json of the result
+ */
+nlohmann::json runJob(std::unique_ptr<Jail> &jail, const Config &base,
+                      const nlohmann::json &desc);
+
+/**
+ * @brief read newline separated job descriptions from in_fd until EOF, run
+ * each of them and write one json line per job to out_fd
+ *
+ * jobs read from the same fd are executed in the same jail, so that
+ * namespaces and mounts are only prepared once. a prepared jail can be
+ * passed in, otherwise one is created on the first job
+ *
+ */
+void serveJobs(int in_fd, int out_fd, const Config &base,
+               std::unique_ptr<Jail> jail = nullptr);
+
+}  // namespace yamc
+
+#endif  // JOB_H_
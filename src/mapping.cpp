@@ -0,0 +1,75 @@
+#include "mapping.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memfd.h"
+
+namespace yamc {
+
+static const char empty[] = "";
+
+MappedFile::MappedFile(const fs::path &path, bool copy)
+    : data_(empty), size_(0) {
+    // not blocking on fifos, which are refused once opened
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error("failed to open " + path.string() + ": " +
+                                 strerror(errno));
+    }
+    try {
+        map_(fd, copy);
+    } catch (const std::exception &e) {
+        close(fd);
+        throw std::runtime_error("failed to map " + path.string() + ": " +
+                                 e.what());
+    }
+    close(fd);
+}
+
+MappedFile::MappedFile(int fd, bool copy) : data_(empty), size_(0) {
+    map_(fd, copy);
+}
+
+void MappedFile::map_(int fd, bool copy) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        throw std::runtime_error(std::string("failed to call fstat: ") +
+                                 strerror(errno));
+    }
+    if (!S_ISREG(st.st_mode)) {
+        throw std::runtime_error("not a regular file");
+    }
+    if (st.st_size == 0) {
+        return;
+    }
+    int copy_fd = copy ? copyToMemfd(fd, "yamc-mapping", st.st_size) : -1;
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE,
+                      copy ? copy_fd : fd, 0);
+    if (copy_fd != -1) {
+        // the mapping keeps the copy
+        close(copy_fd);
+    }
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error(std::string("failed to call mmap: ") +
+                                 strerror(errno));
+    }
+    // read once from start to end
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    data_ = static_cast<const char *>(addr);
+    size_ = st.st_size;
+}
+
+const char *MappedFile::data() const { return data_; }
+
+size_t MappedFile::size() const { return size_; }
+
+MappedFile::~MappedFile() {
+    if (size_ != 0) {
+        munmap(const_cast<char *>(data_), size_);
+    }
+}
+
+}  // namespace yamc
@@ -0,0 +1,45 @@
+#ifndef MAPPING_H_
+#define MAPPING_H_
+
+#include "common.h"
+
+namespace yamc {
+
+/**
+ * a read-only private mapping of a whole file. an empty file maps to an empty
+ * buffer. a file that someone else may still truncate is to be copied first,
+ * or reading the mapping past its new end raises SIGBUS
+ */
+class MappedFile {
+   private:
+    const char *data_;
+    size_t size_;
+
+    void map_(int fd, bool copy);
+
+   public:
+    MappedFile() = delete;
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+    /**
+     * @brief map the regular file at path, which must not be a symlink. with
+     * copy, a sealed copy of it is mapped instead
+     */
+    explicit MappedFile(const fs::path &path, bool copy = false);
+
+    /**
+     * @brief map the regular file fd refers to, or a sealed copy of it. fd is
+     * not owned by the mapping
+     */
+    explicit MappedFile(int fd, bool copy = false);
+
+    const char *data() const;
+
+    size_t size() const;
+
+    ~MappedFile();
+};
+
+}  // namespace yamc
+
+#endif  // MAPPING_H_
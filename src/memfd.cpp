@@ -0,0 +1,108 @@
+#include "memfd.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+
+namespace yamc {
+
+namespace {
+struct CachedMemfd {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    timespec mtime;
+    int fd;
+    uint64_t last_used;
+};
+}  // namespace
+
+static const size_t max_cached_memfds = 16;
+
+static std::map<std::string, CachedMemfd> memfds;
+static uint64_t memfd_clock = 0;
+
+static bool isUnchanged(const CachedMemfd &cached, const struct stat &st) {
+    return cached.dev == st.st_dev && cached.ino == st.st_ino &&
+           cached.size == st.st_size &&
+           cached.mtime.tv_sec == st.st_mtim.tv_sec &&
+           cached.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+int copyToMemfd(int src, const fs::path &path, off_t size) {
+    int fd = memfd_create(path.filename().c_str(),
+                          MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        throw std::runtime_error(std::string("failed to call memfd_create: ") +
+                                 strerror(errno));
+    }
+    off_t offset = 0;
+    while (offset < size) {
+        ssize_t sz = sendfile(fd, src, &offset, size - offset);
+        if (sz <= 0) {
+            close(fd);
+            const char *reason = sz == 0 ? "file shrank" : strerror(errno);
+            throw std::runtime_error("failed to copy " + path.string() +
+                                     ": " + reason);
+        }
+    }
+    if (fcntl(fd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        close(fd);
+        throw std::runtime_error(std::string("failed to seal memfd: ") +
+                                 strerror(errno));
+    }
+    return fd;
+}
+
+int loadMemfd(const fs::path &path) {
+    int src = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src == -1) {
+        throw std::runtime_error("failed to open " + path.string() + ": " +
+                                 strerror(errno));
+    }
+    struct stat st;
+    if (fstat(src, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(src);
+        throw std::runtime_error(path.string() + " is not a regular file");
+    }
+
+    const auto key = fs::absolute(path).lexically_normal().string();
+    auto cached = memfds.find(key);
+    if (cached != memfds.end()) {
+        if (isUnchanged(cached->second, st)) {
+            close(src);
+            cached->second.last_used = ++memfd_clock;
+            return cached->second.fd;
+        }
+        close(cached->second.fd);
+        memfds.erase(cached);
+    }
+
+    int fd;
+    try {
+        fd = copyToMemfd(src, path, st.st_size);
+    } catch (const std::exception &e) {
+        close(src);
+        throw;
+    }
+    close(src);
+
+    if (memfds.size() >= max_cached_memfds) {
+        auto lru = memfds.begin();
+        for (auto it = memfds.begin(); it != memfds.end(); ++it) {
+            if (it->second.last_used < lru->second.last_used) lru = it;
+        }
+        close(lru->second.fd);
+        memfds.erase(lru);
+    }
+    memfds.emplace(key, CachedMemfd{st.st_dev, st.st_ino, st.st_size,
+                                    st.st_mtim, fd, ++memfd_clock});
+    return fd;
+}
+
+}  // namespace yamc
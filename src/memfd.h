@@ -0,0 +1,28 @@
+#ifndef MEMFD_H_
+#define MEMFD_H_
+
+#include <sys/types.h>
+
+#include "common.h"
+
+namespace yamc {
+
+/**
+ * @brief get a sealed memfd holding a copy of the file at path
+ *
+ * memfds are cached per file, so repeated calls for an unchanged file return
+ * the same fd and every execution of it shares the same pages. the fd is
+ * owned by the cache and must not be closed by the caller
+ *
+ */
+int loadMemfd(const fs::path &path);
+
+/**
+ * @brief copy size bytes from src into a new sealed memfd named after path,
+ * which is owned by the caller
+ */
+int copyToMemfd(int src, const fs::path &path, off_t size);
+
+}  // namespace yamc
+
+#endif  // MEMFD_H_
@@ -0,0 +1,45 @@
+#ifndef MESSAGE_H_
+#define MESSAGE_H_
+
+/*
+ * messages exchanged between processes of a jail, and with exec servers
+ * running inside it. a message is a single datagram on a unix seqpacket
+ * socket: an int32_t from enum yamc_message followed by its payload, with
+ * fds attached if any.
+ *
+ * this header is kept C compatible, it is shared with src/preload.
+ */
+
+#include <stdint.h>
+
+enum yamc_message {
+    YAMC_MSG_READY,   /* payload: pid_t of the prepared process, if any */
+    YAMC_MSG_RUN,     /* payload: execution spec, if any */
+    YAMC_MSG_ERROR,   /* no payload */
+    YAMC_MSG_EXITED,  /* payload: int wait status */
+    YAMC_MSG_DONE,    /* payload: struct Result */
+    YAMC_MSG_CLOSED,  /* never sent. peer closed the socket */
+};
+
+/*
+ * payload of YAMC_MSG_RUN sent to an exec server, followed by the json
+ * execution spec. fds to be redirected are attached in the order of stdin,
+ * stdout and stderr.
+ *
+ * the server forks a child for every request. the child applies the
+ * redirections and limits, sends YAMC_MSG_READY with its pid, waits for a
+ * YAMC_MSG_RUN without payload and then closes the server fd and runs the
+ * program. the server waits for the child and sends YAMC_MSG_EXITED.
+ */
+struct yamc_server_request {
+    uint64_t cpu_time_limit; /* seconds */
+    uint64_t output_limit;   /* bytes */
+    uint64_t openfile_limit;
+    uint8_t redirect[3]; /* whether stdin, stdout, stderr are redirected */
+    uint8_t reserved[5];
+};
+
+/* name of the environment variable holding the fd of an exec server */
+#define YAMC_SERVER_FD_ENV "YAMC_SERVER_FD"
+
+#endif /* MESSAGE_H_ */
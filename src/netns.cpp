@@ -0,0 +1,157 @@
+#include "netns.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <glog/raw_logging.h>
+#include <net/if.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+namespace yamc {
+
+// as many as sendMsg passes at once
+static const size_t netns_per_msg = 16;
+
+static std::vector<int> free_netns;
+static size_t netns_capacity = 0;
+
+/**
+ * @brief create n namespaces in a forked process, which unshares one after
+ * another and sends their fds back, as we can not leave a namespace we enter
+ */
+static void createNetns(size_t n) {
+    int sock[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sock) == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+    auto pid = fork();
+    if (pid == -1) {
+        close(sock[0]);
+        close(sock[1]);
+        throw std::runtime_error(strerror(errno));
+    }
+    if (pid == 0) {
+        close(sock[0]);
+        std::vector<int> fds;
+        for (size_t i = 0; i < n; ++i) {
+            int fd = -1;
+            if (unshare(CLONE_NEWNET) == -1 ||
+                (fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC)) == -1) {
+                RAW_LOG(ERROR, "failed to create network namespace: %s",
+                        strerror(errno));
+                _exit(EXIT_FAILURE);
+            }
+            fds.push_back(fd);
+            if (fds.size() == netns_per_msg || i + 1 == n) {
+                char c = 0;
+                if (!sendMsg(sock[1], &c, 1, fds)) {
+                    _exit(EXIT_FAILURE);
+                }
+                for (auto fd : fds) close(fd);
+                fds.clear();
+            }
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(sock[1]);
+    char c;
+    std::vector<int> fds;
+    while (fds.size() < n && recvMsg(sock[0], &c, 1, fds) > 0) {
+    }
+    close(sock[0]);
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0 || fds.size() != n) {
+        for (auto fd : fds) close(fd);
+        throw std::runtime_error("failed to create network namespaces");
+    }
+    free_netns.insert(free_netns.end(), fds.begin(), fds.end());
+}
+
+/**
+ * @brief whether the namespace fd refers to has nothing but loopback, which
+ * is down, checked in a forked process for the same reason
+ */
+static bool isEmpty(int fd) {
+    auto pid = fork();
+    if (pid == -1) {
+        return false;
+    }
+    if (pid == 0) {
+        if (setns(fd, CLONE_NEWNET) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        auto ifs = if_nameindex();
+        if (ifs == nullptr || ifs[0].if_name == nullptr ||
+            strcmp(ifs[0].if_name, "lo") != 0 || ifs[1].if_name != nullptr) {
+            _exit(EXIT_FAILURE);
+        }
+        if_freenameindex(ifs);
+        ifreq ifr{};
+        strncpy(ifr.ifr_name, "lo", IFNAMSIZ - 1);
+        int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock == -1 || ioctl(sock, SIOCGIFFLAGS, &ifr) == -1 ||
+            (ifr.ifr_flags & IFF_UP)) {
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    int status;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+           WEXITSTATUS(status) == 0;
+}
+
+void fillNetnsPool(size_t n) {
+    netns_capacity = n;
+    while (free_netns.size() > n) {
+        close(free_netns.back());
+        free_netns.pop_back();
+    }
+    if (free_netns.size() < n) {
+        createNetns(n - free_netns.size());
+        DLOG(INFO) << n << " network namespaces in the pool";
+    }
+}
+
+int takeNetns() {
+    if (netns_capacity == 0) {
+        return -1;
+    }
+    if (free_netns.empty()) {
+        createNetns(netns_capacity);
+    }
+    int fd = free_netns.back();
+    free_netns.pop_back();
+    return fd;
+}
+
+void giveNetns(int fd, bool trusted) {
+    if (fd == -1) {
+        return;
+    }
+    if (trusted && free_netns.size() < netns_capacity && isEmpty(fd)) {
+        free_netns.push_back(fd);
+        return;
+    }
+    DLOG(INFO) << "dropping network namespace";
+    close(fd);
+}
+
+void adoptNetns(int fd) {
+    if (fd == -1) {
+        return;
+    }
+    for (auto free_fd : free_netns) {
+        close(free_fd);
+    }
+    free_netns = {fd};
+    netns_capacity = 1;
+}
+
+}  // namespace yamc
@@ -0,0 +1,46 @@
+#ifndef NETNS_H_
+#define NETNS_H_
+
+#include "config.h"
+
+namespace yamc {
+
+/**
+ * pool of empty network namespaces created ahead of time and recycled, since
+ * creating and above all destroying one is serialized in the kernel. a jail
+ * takes one when it is created, setns into it instead of unsharing a new one,
+ * and gives it back when it is destroyed. namespaces are kept open by fd
+ */
+
+/**
+ * @brief keep up to n namespaces, creating them at once. n = 0 disables the
+ * pool, so that every jail unshares its own
+ */
+void fillNetnsPool(size_t n);
+
+/**
+ * @brief take a namespace out of the pool, creating more if it runs dry
+ *
+ * @return fd of the namespace, -1 if the pool is disabled
+ */
+int takeNetns();
+
+/**
+ * @brief give a namespace back to the pool if it may be reused and is still
+ * empty: nothing but loopback, which is down. close it otherwise
+ *
+ * @param trusted whether nothing that could change the namespace without a
+ * trace, e.g. root in the jail, has been in it
+ */
+void giveNetns(int fd, bool trusted);
+
+/**
+ * @brief in a process forked off after takeNetns() returned fd, close the
+ * rest of the pool inherited and keep fd for its own jails. fd of -1 is
+ * ignored
+ */
+void adoptNetns(int fd);
+
+}  // namespace yamc
+
+#endif  // NETNS_H_
@@ -0,0 +1,157 @@
+#include "pch.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <regex>
+
+#include "jail.h"
+#include "sha256.h"
+#include "utils.h"
+
+namespace yamc {
+
+static const char build_dir[] = "/.yamc/pch-build";
+static const char gch_dir[] = "bits/stdc++.h.gch";
+static const unsigned long max_pch_size = 1024UL * 1024 * 1024;
+// g++ tries every header of gch_dir in turn, so only a few are kept, and
+// none that went unused for long, e.g. of a replaced compiler
+static const size_t max_pch_count = 8;
+static const auto unused_pch_age = std::chrono::hours(24 * 7);
+// flags g++ failed to build a header with are retried after this long
+static const auto failed_retry_age = std::chrono::hours(1);
+// outside gch_dir, where g++ would take anything for a header
+static const char staging_dir[] = ".build";
+static const char failed_dir[] = ".failed";
+
+static bool isCxxCompiler(const std::string &name) {
+    static const std::regex compiler{R"((.*-)?(g\+\+|c\+\+)(-[0-9.]+)?)"};
+    return std::regex_match(fs::path(name).filename().string(), compiler);
+}
+
+/**
+ * flags a precompiled header has to be built with to be valid for conf:
+ * language, optimization, code generation, debug info and macros
+ */
+static std::vector<std::string> relevantFlags(const Config &conf) {
+    static const char *prefixes[] = {"-std", "-O", "-m", "-f", "-g",
+                                     "-D",   "-U", "-ansi", "-pthread"};
+    std::vector<std::string> flags;
+    const auto &args = conf.cmdline;
+    for (size_t i = 1; i < args.size(); ++i) {
+        const auto &arg = args[i];
+        if ((arg == "-D" || arg == "-U") && i + 1 < args.size()) {
+            flags.emplace_back(arg + args[++i]);
+            continue;
+        }
+        for (auto prefix : prefixes) {
+            if (arg.rfind(prefix, 0) == 0) {
+                flags.emplace_back(arg);
+                break;
+            }
+        }
+    }
+    return flags;
+}
+
+/**
+ * @brief remove the least recently used headers of dir beyond
+ * max_pch_count, and those not used for unused_pch_age
+ */
+static void evictHeaders(const fs::path &dir) {
+    std::vector<std::pair<fs::file_time_type, fs::path>> headers;
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(dir, ec)) {
+        const auto mtime = entry.last_write_time(ec);
+        if (!ec) headers.emplace_back(mtime, entry.path());
+    }
+    std::sort(headers.begin(), headers.end(),
+              [](const auto &a, const auto &b) { return a.first > b.first; });
+    const auto now = fs::file_time_type::clock::now();
+    for (size_t i = 0; i < headers.size(); ++i) {
+        if (i >= max_pch_count || now - headers[i].first > unused_pch_age) {
+            // jails compiling with it keep it open
+            fs::remove(headers[i].second, ec);
+            DLOG(INFO) << "evicted " << headers[i].second;
+        }
+    }
+}
+
+void usePrecompiledHeader(Config &conf) {
+    if (conf.pch_cache.empty() || conf.cmdline.empty() ||
+        !isCxxCompiler(conf.cmdline[0])) {
+        return;
+    }
+
+    std::error_code ec;
+    const auto compiler = fs::canonical(findProgram(conf), ec);
+    struct stat st;
+    if (ec || stat(compiler.c_str(), &st) == -1) {
+        return;
+    }
+    const auto flags = relevantFlags(conf);
+    Sha256 hash;
+    hash.update(compiler.string());
+    hash.update(&st.st_size, sizeof(st.st_size));
+    hash.update(&st.st_mtim, sizeof(st.st_mtim));
+    for (const auto &flag : flags) hash.update(flag);
+    const auto name = hash.hexdigest().substr(0, 32) + ".gch";
+
+    const auto dir = conf.pch_cache / gch_dir;
+    const auto pch = dir / name;
+    const auto failed = conf.pch_cache / failed_dir / name;
+    if (!fs::exists(pch)) {
+        // do not retry flags g++ failed to build a header with for a while
+        const auto failed_at = fs::last_write_time(failed, ec);
+        if (!ec && fs::file_time_type::clock::now() - failed_at <
+                       failed_retry_age) {
+            return;
+        }
+        fs::create_directories(dir);
+        fs::create_directories(conf.pch_cache / staging_dir);
+        fs::create_directories(failed.parent_path());
+        const auto header = conf.pch_cache / "stdc++.h";
+        if (!fs::exists(header)) {
+            std::ofstream(header) << "#include <bits/stdc++.h>\n";
+        }
+
+        Config build = conf;
+        // precompiled headers are way larger than what jobs usually write
+        build.output_limit = std::max(build.output_limit, max_pch_size);
+        build.cmdline = {conf.cmdline[0]};
+        build.cmdline.insert(build.cmdline.end(), flags.begin(), flags.end());
+        build.cmdline.insert(
+            build.cmdline.end(),
+            {"-x", "c++-header",
+             (Config::pch_mount_point / "stdc++.h").string(), "-o",
+             std::string(build_dir) + "/" + name});
+        DLOG(INFO) << "precompiling header " << pch;
+        const auto built = conf.pch_cache / staging_dir / name;
+        if (!buildInJail(build, build_dir, name, built)) {
+            int fd = open(failed.c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd != -1) {
+                // mark the time of this failure, not of the first one
+                futimens(fd, nullptr);
+                close(fd);
+            }
+            return;
+        }
+        fs::remove(failed, ec);
+        fs::rename(built, pch);
+        evictHeaders(dir);
+    } else {
+        // mark as recently used
+        utimensat(AT_FDCWD, pch.c_str(), nullptr, 0);
+    }
+    // searched before the system include directories
+    conf.cmdline.insert(conf.cmdline.begin() + 1,
+                        "-I" + Config::pch_mount_point.string());
+}
+
+}  // namespace yamc
@@ -0,0 +1,23 @@
+#ifndef PCH_H_
+#define PCH_H_
+
+#include "config.h"
+
+namespace yamc {
+
+/**
+ * @brief let a g++ compilation use a precompiled <bits/stdc++.h> kept in
+ * conf.pch_cache, which jails mount read only at Config::pch_mount_point
+ *
+ * headers are precompiled per compiler and set of flags that affect their
+ * validity, in a jail of their own, and published atomically. they all live
+ * in the bits/stdc++.h.gch directory, from which g++ picks the first valid
+ * one, so nothing else is kept there and only a few recently used headers
+ * are. conf is left as is if it does not run g++ or no header can be built
+ *
+ */
+void usePrecompiledHeader(Config &conf);
+
+}  // namespace yamc
+
+#endif  // PCH_H_
@@ -0,0 +1,865 @@
+#include "pipeline.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+#include "compare.h"
+#include "jail.h"
+#include "job.h"
+#include "plugin.h"
+#include "stream.h"
+#include "utils.h"
+
+namespace yamc {
+
+static const size_t max_message_size = 1024;
+static const size_t pipe_size = 1024 * 1024;
+
+static bool succeeded(const nlohmann::json &res) {
+    return res.at("returnCode") == 0 && res.at("signal") == 0;
+}
+
+/**
+ * verdicts of checkers and interactors go to stdout or stderr, which are
+ * kept in a memfd
+ */
+static int openMessage() {
+    int fd = memfd_create("yamc-message", MFD_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error(std::string("failed to call memfd_create: ") +
+                                 strerror(errno));
+    }
+    return fd;
+}
+
+static std::string readMessage(int fd) {
+    char buf[max_message_size];
+    auto sz = pread(fd, buf, sizeof(buf), 0);
+    std::string message(buf, std::max(sz, 0L));
+    message.erase(message.find_last_not_of(" \t\r\n") + 1);
+    return message;
+}
+
+/**
+ * @brief fork a process copying what is written to in_fd into both out_fd
+ * and file_fd. once the reader of out_fd is gone, the rest still goes to
+ * file_fd, so that the copy is complete
+ *
+ * @return pid of the process, which exits with 0 on EOF of in_fd
+ */
+static pid_t teeInput(int in_fd, int out_fd, int file_fd) {
+    auto pid = fork();
+    if (pid == -1) {
+        throw std::runtime_error(std::string("failed to fork: ") +
+                                 strerror(errno));
+    }
+    if (pid != 0) {
+        return pid;
+    }
+    // only syscalls from here on, as in any child of a threaded process
+    signal(SIGPIPE, SIG_IGN);
+    if (dup2(in_fd, STDIN_FILENO) == -1 || dup2(out_fd, STDOUT_FILENO) == -1 ||
+        dup2(file_fd, STDERR_FILENO) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+    // or readers of other pipes of the pipeline would not see EOF
+    if (syscall(SYS_close_range, 3, ~0U, 0) == -1) {
+        for (int fd = 3; fd < 65536; ++fd) close(fd);
+    }
+    bool piped = true;
+    for (;;) {
+        ssize_t sz;
+        if (piped) {
+            sz = tee(STDIN_FILENO, STDOUT_FILENO, pipe_size, 0);
+            if (sz == -1 && errno == EPIPE) {
+                close(STDOUT_FILENO);
+                piped = false;
+                continue;
+            }
+        } else {
+            sz = splice(STDIN_FILENO, nullptr, STDERR_FILENO, nullptr,
+                        pipe_size, SPLICE_F_MOVE);
+        }
+        if (sz == 0) {
+            _exit(EXIT_SUCCESS);
+        }
+        if (sz == -1) {
+            if (errno == EINTR) continue;
+            _exit(EXIT_FAILURE);
+        }
+        // what is teed is moved to the file in full
+        for (ssize_t left = piped ? sz : 0; left > 0;) {
+            auto moved = splice(STDIN_FILENO, nullptr, STDERR_FILENO, nullptr,
+                                left, SPLICE_F_MOVE);
+            if (moved == -1 && errno == EINTR) continue;
+            if (moved <= 0) {
+                _exit(EXIT_FAILURE);
+            }
+            left -= moved;
+        }
+    }
+}
+
+static void appendPaths(nlohmann::json &desc, const nlohmann::json &test,
+                        std::initializer_list<const char *> keys) {
+    for (auto key : keys) {
+        if (!test.contains(key)) {
+            throw std::runtime_error(std::string(key) + " of test is required");
+        }
+        desc["cmdline"].push_back(test.at(key));
+    }
+}
+
+/**
+ * @brief parse a reply of a checker server, `verdict [score] [message]`
+ */
+static nlohmann::json parseVerdict(const std::string &line) {
+    std::istringstream is(line);
+    std::string verdict, word;
+    nlohmann::json res{{"verdict", ""}};
+    if (!(is >> verdict)) {
+        return res;
+    }
+    res["verdict"] = verdict;
+    auto pos = is.tellg();
+    if (is >> word) {
+        char *end;
+        double score = strtod(word.c_str(), &end);
+        if (*end == '\0') {
+            res["score"] = score;
+            pos = is.tellg();
+        }
+    }
+    std::string message = pos == -1 ? "" : line.substr(pos);
+    message.erase(0, message.find_first_not_of(" \t"));
+    message.erase(message.find_last_not_of(" \t\r") + 1);
+    res["message"] = message;
+    return res;
+}
+
+class Pipeline {
+   private:
+    const Config &base_;
+    // of jails running the submission or its generator, with tests hidden
+    Config run_base_;
+    int out_fd_;
+    nlohmann::json generate_, run_, interact_, check_, tests_;
+    bool fail_fast_;
+    // whether the next test may run while one is checked
+    bool overlap_;
+    std::unique_ptr<Jail> generator_, runner_, interactor_, checker_;
+    std::unique_ptr<CheckerPlugin> plugin_;
+    std::unique_ptr<Comparator> comparator_;
+    // stdout of the test started in runner_, if checked while it runs
+    std::unique_ptr<CapturedOutput> streaming_;
+    // the test started in runner_, and its generator or interactor if any
+    std::unique_ptr<Job> generating_, running_, interacting_;
+    int interact_msg_fd_ = -1;
+    // copy of the generated input of the test started in runner_ kept for
+    // the checker, and the process making it
+    int generated_fd_ = -1;
+    pid_t tee_pid_ = -1;
+    int checked_fd_ = -1;  // that of the test being checked
+    // the checker server running in checker_ if check is a server
+    std::unique_ptr<Job> serving_;
+    int check_sock_ = -1, check_msg_fd_ = -1;
+    std::string check_pending_;
+
+    Jail &jail_(std::unique_ptr<Jail> &jail, const Config &conf) {
+        if (!jail) {
+            jail = std::make_unique<Jail>(conf);
+        }
+        jail->prepare();
+        return *jail;
+    }
+
+    void emit_(const nlohmann::json &record) {
+        const auto &s = dumpLine(record);
+        if (!writeToFd(out_fd_, s.c_str(), s.length())) {
+            throw std::runtime_error(std::string("failed to write result: ") +
+                                     strerror(errno));
+        }
+    }
+
+    std::string hostFile_(const nlohmann::json &test, const char *key) const {
+        if (!test.contains(key)) {
+            throw std::runtime_error(std::string(key) + " of test is required");
+        }
+        Config conf = base_;
+        if (run_.contains("chdir")) {
+            conf.chdir_path = run_.at("chdir").get<std::string>();
+        }
+        auto path = hostPath(conf, test.at(key).get<std::string>());
+        if (path.empty()) {
+            throw std::runtime_error(test.at(key).get<std::string>() +
+                                     " is not reachable from host");
+        }
+        return path;
+    }
+
+    /**
+     * @brief hide inputs, outputs and answers of all tests from the jails of
+     * run_base_, as the submission only needs its stdin and stdout, and an
+     * interactive one must not read what the interactor is given. their
+     * directories are hidden as a whole, unless a stage runs in them
+     */
+    void hideTests_(const nlohmann::json &spec) {
+        const auto chdir = base_.chdir_path.string();
+        std::vector<fs::path> workdirs;
+        for (auto key : {"compile", "run", "generate"}) {
+            if (spec.contains(key)) {
+                workdirs.emplace_back(
+                    fs::path(spec.at(key).value("chdir", chdir))
+                        .lexically_normal());
+            }
+        }
+        const fs::path run_dir = run_.value("chdir", chdir);
+        std::set<fs::path> hidden;
+        for (const auto &test : tests_) {
+            for (auto key : {"input", "output", "answer"}) {
+                if (!test.is_object() || !test.contains(key)) {
+                    continue;
+                }
+                const auto path =
+                    (run_dir / test.at(key).get<std::string>())
+                        .lexically_normal();
+                if (key == std::string("output")) {
+                    // or it could not be masked before the test creates it
+                    int fd = open(hostFile_(test, key).c_str(),
+                                  O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+                    if (fd != -1) close(fd);
+                }
+                const auto dir = path.parent_path();
+                bool used = std::any_of(
+                    workdirs.begin(), workdirs.end(), [&](const fs::path &w) {
+                        const auto rel = w.lexically_relative(dir);
+                        return !rel.empty() && *rel.begin() != "..";
+                    });
+                hidden.insert(used ? path : dir);
+            }
+        }
+        // a directory goes before the files in it, which it hides already
+        run_base_.hidden.assign(hidden.begin(), hidden.end());
+    }
+
+    /**
+     * @brief whether files written by running tests, i.e. outputs and saved
+     * inputs, are all distinct, or the next test would truncate the files of
+     * the one being checked
+     */
+    bool distinctFiles_() const {
+        std::set<std::string> written;
+        for (const auto &test : tests_) {
+            if (!test.is_object()) {
+                continue;
+            }
+            if (test.contains("output") &&
+                !written.insert(hostFile_(test, "output")).second) {
+                return false;
+            }
+            if (test.contains("generate") && test.contains("input") &&
+                checkReadsInput_() &&
+                !written.insert(hostFile_(test, "input")).second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void startRun_(size_t i) {
+        const auto &test = tests_.at(i);
+        if (!interact_.is_null()) {
+            startInteraction_(test);
+        } else if (test.contains("generate")) {
+            startGenerated_(test);
+        } else {
+            auto desc = run_;
+            desc["stdin"] = hostFile_(test, "input");
+            redirectOutput_(desc, test);
+            running_ = std::make_unique<Job>(base_, desc);
+            auto &runner = jail_(runner_, run_base_);
+            runner.start(stream_(test, running_->conf()));
+        }
+    }
+
+    /**
+     * @brief whether stdout of tests is checked while they run, by a streamed
+     * compare or a hash
+     */
+    bool streamed_() const {
+        return check_.contains("hash") ||
+               (comparator_ && check_.at("compare").value("stream", false));
+    }
+
+    /**
+     * @brief redirect stdout of the run to output of the test, which can be
+     * left out if the test is checked while it runs
+     */
+    void redirectOutput_(nlohmann::json &desc, const nlohmann::json &test) {
+        if (test.contains("output") || !streamed_()) {
+            desc["stdout"] = hostFile_(test, "output");
+        }
+    }
+
+    /**
+     * @brief conf with stdout checked while the test runs, if the check is
+     * a streamed compare or a hash. the jail must be prepared
+     */
+    Config stream_(const nlohmann::json &test, const Config &conf) {
+        if (!streamed_()) {
+            return conf;
+        }
+        streaming_ = std::make_unique<CapturedOutput>(conf);
+        if (comparator_) {
+            streaming_->compare(*comparator_, hostFile_(test, "answer"));
+        } else {
+            streaming_->hash(hashDesc_(test));
+        }
+        return streaming_->redirect(conf);
+    }
+
+    nlohmann::json hashDesc_(const nlohmann::json &test) const {
+        if (!test.contains("hash")) {
+            throw std::runtime_error("hash of test is required");
+        }
+        auto desc = check_.at("hash");
+        desc["expect"] = test.at("hash");
+        return desc;
+    }
+
+    /**
+     * @brief whether the check of tests reads their input
+     */
+    bool checkReadsInput_() const {
+        return !check_.is_null() && !comparator_ && !check_.contains("hash");
+    }
+
+    /**
+     * @brief run the generator with the arguments given by the test, its
+     * stdout piped into stdin of the program. if the check reads the input,
+     * it is copied on the way into input of the test, or a memfd if left out
+     */
+    void startGenerated_(const nlohmann::json &test) {
+        if (generate_.is_null()) {
+            throw std::runtime_error("generate is required by tests");
+        }
+        auto generate = generate_;
+        for (const auto &arg : test.at("generate")) {
+            generate["cmdline"].push_back(arg);
+        }
+        auto desc = run_;
+        redirectOutput_(desc, test);
+        generating_ = std::make_unique<Job>(base_, generate);
+        running_ = std::make_unique<Job>(base_, desc);
+        auto &generator = jail_(generator_, run_base_);
+        auto &runner = jail_(runner_, run_base_);
+
+        int input[2];
+        makePipe(input, pipe_size);
+        if (checkReadsInput_()) {
+            int generated[2] = {-1, -1};
+            try {
+                makePipe(generated, pipe_size);
+                generated_fd_ =
+                    test.contains("input")
+                        ? open(hostFile_(test, "input").c_str(),
+                               O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW |
+                                   O_CLOEXEC,
+                               0644)
+                        : memfd_create("yamc-input", MFD_CLOEXEC);
+                if (generated_fd_ == -1) {
+                    throw std::runtime_error(
+                        std::string("failed to open input: ") +
+                        strerror(errno));
+                }
+                tee_pid_ = teeInput(generated[0], input[1], generated_fd_);
+            } catch (const std::exception &e) {
+                for (auto fd : {input[0], input[1], generated[0],
+                                generated[1]}) {
+                    if (fd != -1) close(fd);
+                }
+                throw;
+            }
+            close(generated[0]);
+            close(input[1]);
+            input[1] = generated[1];
+        }
+        Config generator_conf = generating_->conf();
+        generator_conf.stdout_fd = input[1];
+        Config conf = running_->conf();
+        conf.stdin_fd = input[0];
+        try {
+            conf = stream_(test, conf);
+            generator.start(generator_conf);
+            runner.start(conf);
+        } catch (const std::exception &e) {
+            close(input[0]);
+            close(input[1]);
+            throw;
+        }
+        close(input[0]);
+        close(input[1]);
+    }
+
+    void startInteraction_(const nlohmann::json &test) {
+        // `interactor input output [answer]`, as testlib expects
+        auto interact = interact_;
+        appendPaths(interact, test, {"input", "output"});
+        if (test.contains("answer")) {
+            interact["cmdline"].push_back(test.at("answer"));
+        }
+        running_ = std::make_unique<Job>(base_, run_);
+        interacting_ = std::make_unique<Job>(base_, interact);
+        // cloned before the pipes are created, or they would keep the write
+        // ends open and never see EOF
+        auto &runner = jail_(runner_, run_base_);
+        auto &interactor = jail_(interactor_, base_);
+
+        int to_run[2], from_run[2];
+        makePipe(to_run, pipe_size);
+        try {
+            makePipe(from_run, pipe_size);
+        } catch (const std::exception &e) {
+            close(to_run[0]);
+            close(to_run[1]);
+            throw;
+        }
+        Config conf = running_->conf();
+        conf.stdin_fd = to_run[0];
+        conf.stdout_fd = from_run[1];
+        Config interactor_conf = interacting_->conf();
+        interactor_conf.stdin_fd = from_run[0];
+        interactor_conf.stdout_fd = to_run[1];
+        try {
+            interact_msg_fd_ = openMessage();
+            interactor_conf.stderr_fd = interact_msg_fd_;
+            interactor.start(interactor_conf);
+            runner.start(conf);
+        } catch (const std::exception &e) {
+            for (auto fd : {to_run[0], to_run[1], from_run[0], from_run[1]}) {
+                close(fd);
+            }
+            throw;
+        }
+        for (auto fd : {to_run[0], to_run[1], from_run[0], from_run[1]}) {
+            close(fd);
+        }
+    }
+
+    /**
+     * @brief wait for the test started by startRun_() and add its results to
+     * record. return true if it passes so far
+     */
+    bool waitRun_(nlohmann::json &record) {
+        if (streaming_) {
+            streaming_->pump(*runner_);
+        }
+        auto run = runner_->wait().to_json();
+        running_.reset();
+        bool passed = succeeded(run);
+        if (streaming_) {
+            auto verdicts = streaming_->report(run);
+            streaming_.reset();
+            for (auto key : {"compare", "hash"}) {
+                if (verdicts.contains(key)) {
+                    record["check"] = verdicts.at(key);
+                    passed = passed && verdicts.at(key).at("verdict") == "ok";
+                }
+            }
+        }
+        record["run"] = run;
+
+        if (generating_) {
+            auto generator = generator_->wait().to_json();
+            generating_.reset();
+            record["generator"] = generator;
+            // killed by SIGPIPE if the program did not read all of its
+            // input, unless it is copied for the check, which reads all
+            bool generated = succeeded(generator) ||
+                             (tee_pid_ == -1 &&
+                              generator.at("signal") == SIGPIPE);
+            if (tee_pid_ != -1) {
+                int status;
+                generated = TEMP_FAILURE_RETRY(waitpid(tee_pid_, &status,
+                                                       0)) != -1 &&
+                            WIFEXITED(status) &&
+                            WEXITSTATUS(status) == EXIT_SUCCESS &&
+                            generated;
+                tee_pid_ = -1;
+            }
+            if (!generated) {
+                // not a failure of the submission
+                record["error"] = "generator failed";
+                passed = false;
+            }
+        }
+        if (interacting_) {
+            auto interactor = interactor_->wait().to_json();
+            interacting_.reset();
+            interactor["message"] = readMessage(interact_msg_fd_);
+            close(interact_msg_fd_);
+            interact_msg_fd_ = -1;
+            record["interactor"] = interactor;
+            passed = passed && succeeded(interactor);
+        }
+        return passed;
+    }
+
+    /**
+     * @brief start the checker once in checker_, with both stdin and stdout
+     * connected to check_sock_
+     *
+     * limits of check are meant for every test. the server as a whole gets
+     * them times the number of tests, its real time also covering the runs
+     * it waits for, and askCheckServer_() kills it if a single test takes
+     * longer than the real time limit
+     */
+    void startCheckServer_() {
+        serving_ = std::make_unique<Job>(base_, check_);
+        auto &checker = jail_(checker_, base_);
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+            throw std::runtime_error(
+                std::string("failed to call socketpair: ") + strerror(errno));
+        }
+        Config conf = serving_->conf();
+        const auto tests = static_cast<long>(tests_.size());
+        auto idle = std::chrono::seconds(0);
+        for (const auto *stage : {&run_, &generate_, &interact_}) {
+            if (!stage->is_null()) {
+                idle = std::max(idle, std::chrono::seconds(stage->value(
+                                          "real",
+                                          base_.real_time_limit.count())));
+            }
+        }
+        conf.cpu_time_limit *= tests;
+        conf.real_time_limit = (conf.real_time_limit + idle) * tests;
+        conf.stdin_fd = conf.stdout_fd = fds[1];
+        try {
+            check_msg_fd_ = openMessage();
+            conf.stderr_fd = check_msg_fd_;
+            checker.start(conf);
+        } catch (const std::exception &e) {
+            close(fds[0]);
+            close(fds[1]);
+            stopCheckServer_();
+            checker_.reset();
+            throw;
+        }
+        close(fds[1]);
+        check_sock_ = fds[0];
+        check_pending_.clear();
+    }
+
+    /**
+     * @brief let the checker server see EOF and wait for it to exit. return
+     * its result with the message it left on stderr
+     */
+    nlohmann::json stopCheckServer_() {
+        nlohmann::json res;
+        if (check_sock_ != -1) {
+            close(check_sock_);
+            check_sock_ = -1;
+            res = checker_->wait().to_json();
+            res["message"] = readMessage(check_msg_fd_);
+        }
+        if (check_msg_fd_ != -1) {
+            close(check_msg_fd_);
+            check_msg_fd_ = -1;
+        }
+        serving_.reset();
+        return res;
+    }
+
+    /**
+     * @brief send the paths of a test to the checker server and read its
+     * verdict. the server is restarted for the next test if it exits
+     */
+    nlohmann::json askCheckServer_(const nlohmann::json &test) {
+        if (check_sock_ == -1) {
+            startCheckServer_();
+        }
+        std::string request;
+        for (auto key : {"input", "output", "answer"}) {
+            if (!test.contains(key)) {
+                throw std::runtime_error(std::string(key) +
+                                         " of test is required");
+            }
+            request += test.at(key).get<std::string>() + "\n";
+        }
+
+        size_t end = std::string::npos;
+        bool sent = true;
+        for (size_t off = 0; off < request.length();) {
+            auto sz = TEMP_FAILURE_RETRY(send(check_sock_, &request[off],
+                                              request.length() - off,
+                                              MSG_NOSIGNAL));
+            if (sz < 0) {
+                sent = false;
+                break;
+            }
+            off += sz;
+        }
+        char buf[max_message_size];
+        const auto deadline = std::chrono::steady_clock::now() +
+                              serving_->conf().real_time_limit;
+        bool timeout = false;
+        while (sent &&
+               (end = check_pending_.find('\n')) == std::string::npos) {
+            const auto left =
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now());
+            pollfd pfd{check_sock_, POLLIN, 0};
+            if (left.count() <= 0 ||
+                TEMP_FAILURE_RETRY(poll(&pfd, 1, left.count())) == 0) {
+                timeout = true;
+                break;
+            }
+            auto sz = TEMP_FAILURE_RETRY(read(check_sock_, buf, sizeof(buf)));
+            if (sz <= 0) {
+                break;
+            }
+            check_pending_.append(buf, sz);
+        }
+        if (!sent || end == std::string::npos) {
+            LOG(WARNING) << "checker server "
+                         << (timeout ? "timed out" : "exited");
+            if (timeout) {
+                checker_->killJailed();
+            }
+            auto res = stopCheckServer_();
+            // a failure of the judge, not of the submission
+            res["verdict"] = "fail";
+            return res;
+        }
+        auto res = parseVerdict(check_pending_.substr(0, end));
+        check_pending_.erase(0, end + 1);
+        return res;
+    }
+
+    /**
+     * @brief check the test run before, its generated input if any kept in
+     * input_fd
+     */
+    nlohmann::json checkTest_(nlohmann::json test, int input_fd) {
+        // generated input that is not saved to input is in a memfd, which is
+        // stdin of checkers
+        const bool in_memfd =
+            test.contains("generate") && !test.contains("input");
+        if (in_memfd) {
+            test["input"] = "/proc/self/fd/0";
+        }
+        if (comparator_) {
+            return comparator_->compare(hostFile_(test, "output"),
+                                        hostFile_(test, "answer"));
+        }
+        if (check_.contains("hash")) {
+            // interactive tests are not streamed. copied in case a process
+            // left behind by the run still writes it
+            OutputHash hash{hashDesc_(test)};
+            MappedFile output{hostFile_(test, "output"), true};
+            hash.feed(output.data(), output.size());
+            return hash.digest(output.size());
+        }
+        if (plugin_) {
+            return plugin_->check(
+                in_memfd ? "/proc/self/fd/" + std::to_string(input_fd)
+                         : hostFile_(test, "input"),
+                hostFile_(test, "output"), hostFile_(test, "answer"),
+                check_.value("args", std::vector<std::string>{}));
+        }
+        if (check_.value("server", false)) {
+            if (in_memfd) {
+                throw std::runtime_error(
+                    "input of generated tests is required by checker servers");
+            }
+            return askCheckServer_(test);
+        }
+        auto desc = check_;
+        appendPaths(desc, test, {"input", "output", "answer"});
+        Job job{base_, desc};
+        Config conf = job.conf();
+
+        int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (null_fd == -1) {
+            throw std::runtime_error(std::string("failed to open: ") +
+                                     strerror(errno));
+        }
+        int msg_fd = -1;
+        nlohmann::json res;
+        try {
+            msg_fd = openMessage();
+            conf.stdin_fd = null_fd;
+            if (in_memfd && lseek(input_fd, 0, SEEK_SET) == 0) {
+                conf.stdin_fd = input_fd;
+            }
+            conf.stdout_fd = conf.stderr_fd = msg_fd;
+            res = jail_(checker_, base_).exec(conf).to_json();
+        } catch (const std::exception &e) {
+            close(null_fd);
+            close(msg_fd);
+            checker_.reset();
+            throw;
+        }
+        res["message"] = readMessage(msg_fd);
+        close(null_fd);
+        close(msg_fd);
+        return res;
+    }
+
+   public:
+    Pipeline(const Config &base, int out_fd, const nlohmann::json &spec)
+        : base_(base), run_base_(base), out_fd_(out_fd) {
+        if (!spec.is_object() || !spec.contains("run") ||
+            !spec.contains("tests")) {
+            throw std::runtime_error("run and tests are required");
+        }
+        run_ = spec.at("run");
+        tests_ = spec.at("tests");
+        if (!run_.is_object() || !tests_.is_array()) {
+            throw std::runtime_error("invalid run or tests");
+        }
+        for (auto [key, stage] : {std::make_pair("generate", &generate_),
+                                  std::make_pair("interact", &interact_),
+                                  std::make_pair("check", &check_)}) {
+            if (spec.contains(key)) {
+                *stage = spec.at(key);
+                // checker plugins and comparators are called in-process
+                bool in_process =
+                    stage == &check_ &&
+                    (stage->contains("plugin") || stage->contains("compare") ||
+                     stage->contains("hash"));
+                if (!stage->is_object() ||
+                    !(stage->contains("cmdline") || in_process)) {
+                    throw std::runtime_error(std::string("cmdline of ") + key +
+                                             " is required");
+                }
+            }
+        }
+        if (!generate_.is_null() && !interact_.is_null()) {
+            throw std::runtime_error("interactive tests can not be generated");
+        }
+        fail_fast_ = spec.value("failFast", false);
+        hideTests_(spec);
+
+        // namespaces and mounts of all jails are prepared in the background
+        if (!generate_.is_null()) {
+            jail_(generator_, run_base_);
+        }
+        jail_(runner_, run_base_);
+        if (!interact_.is_null()) {
+            jail_(interactor_, base_);
+        }
+        if (check_.contains("compare")) {
+            comparator_ = std::make_unique<Comparator>(check_.at("compare"));
+        } else if (check_.contains("plugin")) {
+            plugin_ = std::make_unique<CheckerPlugin>(
+                check_.at("plugin").get<std::string>());
+        } else if (!check_.is_null()) {
+            jail_(checker_, base_);
+        }
+        overlap_ = distinctFiles_();
+        if (!overlap_) {
+            LOG(WARNING) << "tests share files, checked one at a time";
+        }
+    }
+
+    ~Pipeline() {
+        if (interact_msg_fd_ != -1) {
+            close(interact_msg_fd_);
+        }
+        for (auto fd : {generated_fd_, checked_fd_}) {
+            if (fd != -1) close(fd);
+        }
+        if (tee_pid_ != -1) {
+            kill(tee_pid_, SIGKILL);
+            waitpid(tee_pid_, nullptr, 0);
+        }
+        try {
+            stopCheckServer_();
+        } catch (const std::exception &e) {
+            LOG(ERROR) << "failed to stop checker server: " << e.what();
+        }
+    }
+
+    bool compile(const nlohmann::json &desc) {
+        auto res = runJob(runner_, run_base_, desc);
+        emit_({{"compile", res}});
+        return succeeded(res);
+    }
+
+    void judge() {
+        if (tests_.empty()) {
+            return;
+        }
+        startRun_(0);
+        for (size_t i = 0; i < tests_.size(); ++i) {
+            nlohmann::json record{{"test", i}};
+            bool accepted = waitRun_(record);
+            // taken before the next test generates its own
+            if (checked_fd_ != -1) {
+                close(checked_fd_);
+            }
+            checked_fd_ = generated_fd_;
+            generated_fd_ = -1;
+            bool next = i + 1 < tests_.size() && (accepted || !fail_fast_);
+            if (next && overlap_) {
+                startRun_(i + 1);
+            }
+
+            // streamed tests are checked while they run
+            if (accepted && !check_.is_null() && !record.contains("check")) {
+                auto check = checkTest_(tests_.at(i), checked_fd_);
+                // checker servers answer with a verdict
+                accepted = check.contains("verdict")
+                               ? check.at("verdict") == "ok"
+                               : succeeded(check);
+                if (check.value("verdict", "") == "fail") {
+                    record["error"] = "checker failed";
+                }
+                record["check"] = check;
+            }
+            record["accepted"] = accepted;
+            emit_(record);
+
+            if (!accepted && fail_fast_) {
+                if (next && overlap_) {
+                    nlohmann::json discarded;
+                    waitRun_(discarded);
+                }
+                return;
+            }
+            if (next && !overlap_) {
+                startRun_(i + 1);
+            }
+        }
+    }
+};
+
+void runPipeline(int in_fd, int out_fd, const Config &base) {
+    try {
+        const auto spec = nlohmann::json::parse(readAllFromFd(in_fd));
+        Pipeline pipeline{base, out_fd, spec};
+        if (spec.contains("compile") && !pipeline.compile(spec.at("compile"))) {
+            return;
+        }
+        pipeline.judge();
+    } catch (const std::exception &e) {
+        LOG(ERROR) << "failed to run pipeline: " << e.what();
+        const auto &s = dumpLine({{"error", e.what()}});
+        writeToFd(out_fd, s.c_str(), s.length());
+    }
+}
+
+}  // namespace yamc
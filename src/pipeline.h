@@ -0,0 +1,74 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include "config.h"
+
+namespace yamc {
+
+/**
+ * @brief judge a submission described by the json object read from in_fd
+ * until EOF, e.g.
+ * {"compile": {"cmdline": ["g++", "a.cpp"]},
+ *  "run": {"cmdline": ["./a.out"], "cpu": 1},
+ *  "check": {"cmdline": ["./checker"]},
+ *  "tests": [{"input": "1.in", "output": "1.out", "answer": "1.ans"}]}
+ *
+ * the stages are jobs (see job.h), compile and check being optional. paths
+ * of tests are seen inside the jail, relative to the chdir of run. each test
+ * is run with input as stdin and output as stdout, then checked with
+ * `checker input output answer`, and passes if both exit with 0. inputs,
+ * outputs and answers of all tests are hidden from the jails of compile, run
+ * and generate
+ *
+ * a test with "generate" takes its input from the job "generate" of the
+ * submission, run with the arguments listed by the test in a jail of its
+ * own. its stdout is piped right into stdin of the program. if the check
+ * reads input, the input is copied on the way into "input" of the test, or
+ * a memfd given to checkers as stdin and /proc/self/fd/0 if it is left out,
+ * and the generator runs to the end even if the program stops reading. a
+ * generator that fails is not a failure of the submission: the test is not
+ * checked and gets "error" in its record
+ *
+ * a check with "server": true is a checker server instead. it is started
+ * once, and for every test reads the lines `input\noutput\nanswer\n` from
+ * stdin and writes a line `verdict [score] [message]` to stdout. the test
+ * passes if verdict is "ok". limits of check apply to every test: the server
+ * is killed if it takes longer than the real time limit to answer, and has
+ * the limits times the number of tests in total. it is started again for the
+ * next test if it exits
+ *
+ * a checker that fails, i.e. a checker server that exits or times out, or a
+ * verdict "fail", is not a failure of the submission: the record of the
+ * test gets "error" as well
+ *
+ * a check with "plugin" instead of "cmdline" names a trusted checker plugin
+ * on the host (see checker.h), loaded once and called in-process on the
+ * files mapped into memory, with "args" as its arguments. a check with
+ * "compare" compares output with answer by the built-in comparator instead,
+ * e.g. {"compare": {"mode": "float", "eps": 1e-6}}. see compare.h. with
+ * "stream": true in it, stdout of a test that is not interactive is compared
+ * while the test runs, which is killed at the first difference. a check
+ * with "hash" instead, e.g. {"hash": {"mode": "tokens"}}, hashes stdout while
+ * the test runs and compares it with "hash" of the test, with no answer
+ * read. see stream.h. "output" of tests is optional for both
+ *
+ * for interactive problems, "interact" is a job run as
+ * `interactor input output [answer]` in a jail of its own, alongside each
+ * test. stdin and stdout of the interactor and the program are connected by
+ * pipes, and the test passes if both exit with 0 (and the checker, if any)
+ *
+ * one json line is written to out_fd per stage as soon as it is done:
+ * {"compile": result} first, then {"test": i, "generator": result, "run":
+ * result, "interactor": result, "check": result, "accepted": bool} for every
+ * test. checking a test overlaps with running the next one, in another jail
+ * prepared during compilation, as long as outputs and saved inputs of all
+ * tests are distinct files. tests sharing any of them are checked before the
+ * next one starts instead. stops after the first failed test if "failFast"
+ * is true
+ *
+ */
+void runPipeline(int in_fd, int out_fd, const Config &base);
+
+}  // namespace yamc
+
+#endif  // PIPELINE_H_
@@ -0,0 +1,60 @@
+#include "plugin.h"
+
+#include <dlfcn.h>
+
+#include "mapping.h"
+#include "utils.h"
+
+namespace yamc {
+
+CheckerPlugin::CheckerPlugin(const fs::path &path) {
+    handle_ = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle_ == nullptr) {
+        throw std::runtime_error(std::string("failed to load plugin: ") +
+                                 dlerror());
+    }
+    check_ = reinterpret_cast<yamc_check_fn>(dlsym(handle_, YAMC_CHECK_SYMBOL));
+    if (check_ == nullptr) {
+        dlclose(handle_);
+        throw std::runtime_error(path.string() + " has no " +
+                                 YAMC_CHECK_SYMBOL);
+    }
+}
+
+nlohmann::json CheckerPlugin::check(
+    const fs::path &input, const fs::path &output, const fs::path &answer,
+    const std::vector<std::string> &args) const {
+    std::unique_ptr<MappedFile> in;
+    if (!input.empty()) {
+        in = std::make_unique<MappedFile>(input);
+    }
+    // the output was written by the submission, which may still hold it
+    MappedFile out{output, true}, ans{answer};
+    auto argv = strvec2cstr(args);
+
+    yamc_check_request req{
+        {in ? in->data() : "", in ? in->size() : 0},
+        {out.data(), out.size()},
+        {ans.data(), ans.size()},
+        static_cast<int>(args.size()),
+        argv.data(),
+    };
+    yamc_check_reply reply;
+    memset(&reply, 0, sizeof(reply));
+    int ret = check_(&req, &reply);
+    reply.message[sizeof(reply.message) - 1] = '\0';
+
+    if (ret != 0) {
+        return {{"verdict", "fail"}, {"score", 0}, {"message", reply.message}};
+    }
+    if (reply.accepted && reply.score == 0) {
+        reply.score = 1;
+    }
+    return {{"verdict", reply.accepted ? "ok" : "wa"},
+            {"score", reply.score},
+            {"message", reply.message}};
+}
+
+CheckerPlugin::~CheckerPlugin() { dlclose(handle_); }
+
+}  // namespace yamc
@@ -0,0 +1,39 @@
+#ifndef PLUGIN_H_
+#define PLUGIN_H_
+
+#include "common.h"
+#include "checker.h"
+
+namespace yamc {
+
+/**
+ * a trusted checker plugin (see checker.h) loaded into yamc
+ */
+class CheckerPlugin {
+   private:
+    void *handle_;
+    yamc_check_fn check_;
+
+   public:
+    CheckerPlugin() = delete;
+    CheckerPlugin(CheckerPlugin const &) = delete;
+    CheckerPlugin &operator=(CheckerPlugin const &) = delete;
+    explicit CheckerPlugin(const fs::path &path);
+
+    /**
+     * @brief judge output against answer with the files mapped into memory.
+     * input may be empty if it is not kept
+     *
+     * @return {"verdict": "ok" or "wa", "score": ..., "message": ...}, or
+     * "fail" as the verdict if the plugin failed to check
+     */
+    nlohmann::json check(const fs::path &input, const fs::path &output,
+                         const fs::path &answer,
+                         const std::vector<std::string> &args) const;
+
+    ~CheckerPlugin();
+};
+
+}  // namespace yamc
+
+#endif  // PLUGIN_H_
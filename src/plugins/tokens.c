@@ -0,0 +1,100 @@
+/*
+ * checker plugin comparing whitespace separated tokens of the output and the
+ * answer. with an argument, tokens that are both numbers are compared with it
+ * as the absolute or relative error allowed, e.g. 1e-6.
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../checker.h"
+
+struct cursor {
+    const char *p, *end;
+};
+
+static int nextToken(struct cursor *c, const char **tok, size_t *len) {
+    while (c->p < c->end && isspace((unsigned char)*c->p)) ++c->p;
+    if (c->p == c->end) return 0;
+    *tok = c->p;
+    while (c->p < c->end && !isspace((unsigned char)*c->p)) ++c->p;
+    *len = c->p - *tok;
+    return 1;
+}
+
+static int parseNumber(const char *tok, size_t len, double *val) {
+    char buf[64];
+    char *end;
+    if (len == 0 || len >= sizeof(buf)) return 0;
+    memcpy(buf, tok, len);
+    buf[len] = '\0';
+    *val = strtod(buf, &end);
+    return *end == '\0' && !isnan(*val);
+}
+
+/* at most 32 bytes of a token, with bytes other than printable ascii replaced
+ * so that the message is valid utf-8 */
+static void quote(char *buf, const char *tok, size_t len) {
+    size_t i;
+    if (len > 32) len = 32;
+    for (i = 0; i < len; ++i) {
+        unsigned char ch = tok[i];
+        buf[i] = ch >= 0x20 && ch < 0x7f ? ch : '?';
+    }
+    buf[len] = '\0';
+}
+
+static int sameNumber(double a, double b, double eps) {
+    double diff = fabs(a - b);
+    return diff <= eps || diff <= eps * fabs(b);
+}
+
+int yamc_check(const struct yamc_check_request *req,
+               struct yamc_check_reply *reply) {
+    struct cursor out = {req->output.data, req->output.data + req->output.size};
+    struct cursor ans = {req->answer.data, req->answer.data + req->answer.size};
+    double eps = -1;
+    char *end;
+    if (req->argc > 0) {
+        eps = strtod(req->argv[0], &end);
+        if (*end != '\0' || eps < 0) {
+            snprintf(reply->message, sizeof(reply->message),
+                     "invalid error %s", req->argv[0]);
+            return 1;
+        }
+    }
+
+    for (size_t n = 1;; ++n) {
+        const char *a, *b;
+        size_t la, lb;
+        double x, y;
+        int has_out = nextToken(&out, &a, &la);
+        int has_ans = nextToken(&ans, &b, &lb);
+        if (!has_out && !has_ans) {
+            snprintf(reply->message, sizeof(reply->message), "%zu tokens",
+                     n - 1);
+            reply->accepted = 1;
+            return 0;
+        }
+        if (!has_out || !has_ans) {
+            snprintf(reply->message, sizeof(reply->message),
+                     "%s ends at token %zu", has_out ? "answer" : "output", n);
+            return 0;
+        }
+        if (la == lb && memcmp(a, b, la) == 0) continue;
+        if (eps >= 0 && parseNumber(a, la, &x) && parseNumber(b, lb, &y) &&
+            sameNumber(x, y, eps)) {
+            continue;
+        }
+        char expected[33], found[33];
+        quote(expected, b, lb);
+        quote(found, a, la);
+        snprintf(reply->message, sizeof(reply->message),
+                 "token %zu differs, expected %s, found %s", n, expected,
+                 found);
+        return 0;
+    }
+}
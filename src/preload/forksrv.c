@@ -0,0 +1,156 @@
+/*
+ * fork server, preloaded into the program by the jail holder.
+ *
+ * the constructor runs once the dynamic linker has loaded and relocated the
+ * program and initialized the libraries it depends on, but before any
+ * constructor of the program itself. it then serves requests on the fd
+ * named by YAMC_SERVER_FD (see message.h) and returns only in forked
+ * children, which go on to run the program as if it had just been exec'd.
+ *
+ * this library must not depend on anything but libc, since it is loaded
+ * into arbitrary programs.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../message.h"
+
+#define MAX_MSG_SIZE (64 * 1024)
+#define MAX_FDS 3
+
+static int sendMsg(int sock, int32_t type, const void *payload, size_t len) {
+    char buf[sizeof(int32_t) + sizeof(int)];
+    if (len > sizeof(buf) - sizeof(int32_t)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(buf, &type, sizeof(int32_t));
+    memcpy(buf + sizeof(int32_t), payload, len);
+    return TEMP_FAILURE_RETRY(
+               send(sock, buf, sizeof(int32_t) + len, MSG_NOSIGNAL)) == -1
+               ? -1
+               : 0;
+}
+
+static ssize_t recvMsg(int sock, char *buf, size_t len, int *fds,
+                       size_t *nfds) {
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)]
+        __attribute__((aligned(sizeof(size_t))));
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *nfds = 0;
+    ssize_t sz = TEMP_FAILURE_RETRY(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC));
+    if (sz <= 0) {
+        return sz;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            *nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *nfds);
+        }
+    }
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return sz;
+}
+
+/*
+ * prepare the forked child and wait for the go from the jail. returns 0 if
+ * the child should go on to run the program
+ */
+static int prepareChild(int sock, const struct yamc_server_request *req,
+                        const int *fds, size_t nfds) {
+    size_t next = 0;
+    for (int i = 0; i < 3; ++i) {
+        if (!req->redirect[i]) continue;
+        if (next == nfds || dup2(fds[next++], i) == -1) return -1;
+    }
+    for (size_t i = 0; i < nfds; ++i) close(fds[i]);
+
+    struct rlimit cpu = {req->cpu_time_limit, req->cpu_time_limit};
+    struct rlimit file = {req->output_limit, req->output_limit};
+    struct rlimit nfd = {req->openfile_limit, req->openfile_limit};
+    if (setrlimit(RLIMIT_CPU, &cpu) == -1 ||
+        setrlimit(RLIMIT_FSIZE, &file) == -1 ||
+        setrlimit(RLIMIT_NOFILE, &nfd) == -1) {
+        return -1;
+    }
+    prctl(PR_SET_DUMPABLE, 1);
+
+    pid_t pid = getpid();
+    char buf[sizeof(int32_t)];
+    int unused[MAX_FDS];
+    size_t nunused;
+    if (sendMsg(sock, YAMC_MSG_READY, &pid, sizeof(pid)) == -1 ||
+        recvMsg(sock, buf, sizeof(buf), unused, &nunused) <= 0) {
+        return -1;
+    }
+    close(sock);
+    return 0;
+}
+
+__attribute__((constructor)) static void serve(void) {
+    const char *env = getenv(YAMC_SERVER_FD_ENV);
+    if (env == NULL) {
+        return;
+    }
+    int sock = atoi(env);
+    unsetenv(YAMC_SERVER_FD_ENV);
+    unsetenv("LD_PRELOAD");
+    // children must not be able to touch the server
+    prctl(PR_SET_DUMPABLE, 0);
+
+    static char buf[MAX_MSG_SIZE];
+    for (;;) {
+        int fds[MAX_FDS];
+        size_t nfds;
+        ssize_t sz = recvMsg(sock, buf, sizeof(buf), fds, &nfds);
+        int32_t type;
+        if (sz < (ssize_t)(sizeof(int32_t) +
+                           sizeof(struct yamc_server_request))) {
+            _exit(sz == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        memcpy(&type, buf, sizeof(int32_t));
+        if (type != YAMC_MSG_RUN) {
+            _exit(EXIT_FAILURE);
+        }
+        struct yamc_server_request req;
+        memcpy(&req, buf + sizeof(int32_t), sizeof(req));
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (prepareChild(sock, &req, fds, nfds) == 0) {
+                return;
+            }
+            sendMsg(sock, YAMC_MSG_ERROR, NULL, 0);
+            _exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < nfds; ++i) close(fds[i]);
+
+        int status = EXIT_FAILURE << 8;
+        if (pid == -1) {
+            sendMsg(sock, YAMC_MSG_ERROR, NULL, 0);
+        } else if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        if (sendMsg(sock, YAMC_MSG_EXITED, &status, sizeof(status)) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
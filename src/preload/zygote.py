@@ -0,0 +1,205 @@
+"""
+zygote for python programs, started by the jail holder in place of
+`python3 script.py args...` with YAMC_SERVER_FD set.
+
+commonly used modules are imported once. every request then forks a child
+that runs the script named in the execution spec as __main__, just like a
+freshly started interpreter would. see src/message.h for the protocol.
+"""
+
+import array
+import atexit
+import gc
+import json
+import os
+import pkgutil  # noqa: F401, imported by runpy.run_path
+import resource
+import runpy
+import socket
+import struct
+import sys
+import traceback
+
+# imported once for the programs forked off the zygote
+import bisect  # noqa: F401
+import collections  # noqa: F401
+import copy  # noqa: F401
+import decimal  # noqa: F401
+import fractions  # noqa: F401
+import functools  # noqa: F401
+import heapq  # noqa: F401
+import io  # noqa: F401
+import itertools  # noqa: F401
+import math  # noqa: F401
+import operator  # noqa: F401
+import random  # noqa: F401
+import re  # noqa: F401
+import string  # noqa: F401
+
+READY, RUN, ERROR, EXITED = 0, 1, 2, 3
+HEADER = struct.Struct("=i")
+REQUEST = struct.Struct("=QQQ3B5x")
+MAX_MSG_SIZE = 64 * 1024
+MAX_FDS = 3
+PR_SET_DUMPABLE = 4
+
+
+def set_dumpable(dumpable):
+    try:
+        import ctypes
+
+        libc = ctypes.CDLL(None, use_errno=True)
+        libc.prctl(PR_SET_DUMPABLE, dumpable, 0, 0, 0)
+    except (ImportError, OSError, AttributeError):
+        pass
+
+
+def send(sock, msg, payload=b""):
+    sock.sendmsg([HEADER.pack(msg) + payload])
+
+
+def recv(sock):
+    fds = array.array("i")
+    data, ancdata, _, _ = sock.recvmsg(
+        MAX_MSG_SIZE,
+        socket.CMSG_SPACE(MAX_FDS * fds.itemsize),
+        socket.MSG_CMSG_CLOEXEC,
+    )
+    for level, kind, cdata in ancdata:
+        if level == socket.SOL_SOCKET and kind == socket.SCM_RIGHTS:
+            fds.frombytes(cdata[: len(cdata) - len(cdata) % fds.itemsize])
+    if len(data) < HEADER.size:
+        return None, b"", list(fds)
+    return HEADER.unpack_from(data)[0], data[HEADER.size :], list(fds)
+
+
+def exit_code(exc):
+    # same as the interpreter does for an uncaught SystemExit
+    if exc.code is None:
+        return 0
+    if isinstance(exc.code, int):
+        return exc.code & 0xFF
+    print(exc.code, file=sys.stderr)
+    return 1
+
+
+def run_script(script):
+    code = 0
+    try:
+        runpy.run_path(script, run_name="__main__")
+    except SystemExit as exc:
+        code = exit_code(exc)
+    except BaseException as exc:
+        # hide frames of the zygote and runpy
+        tb = exc.__traceback__
+        while tb is not None and tb.tb_frame.f_code.co_filename != script:
+            tb = tb.tb_next
+        traceback.print_exception(type(exc), exc, tb)
+        code = 1
+    return code
+
+
+def shutdown(code):
+    """
+    exit as the interpreter does as far as the script can tell: wait for its
+    threads, run atexit handlers and flush stdio. the rest of finalization
+    would only touch, and copy, every page shared with the zygote
+    """
+    threading = sys.modules.get("threading")
+    if threading is not None and hasattr(threading, "_shutdown"):
+        threading._shutdown()
+    atexit._run_exitfuncs()
+    try:
+        sys.stdout.flush()
+        sys.stderr.flush()
+    except OSError:
+        code = 120
+    os._exit(code)
+
+
+def prepare_child(sock, request, fds):
+    cpu, fsize, nfd, *redirect = REQUEST.unpack_from(request)
+    pending = iter(fds)
+    for target, redirected in enumerate(redirect):
+        if redirected:
+            os.dup2(next(pending), target)
+    for fd in fds:
+        os.close(fd)
+    resource.setrlimit(resource.RLIMIT_CPU, (cpu, cpu))
+    resource.setrlimit(resource.RLIMIT_FSIZE, (fsize, fsize))
+    resource.setrlimit(resource.RLIMIT_NOFILE, (nfd, nfd))
+    set_dumpable(1)
+
+    send(sock, READY, struct.pack("=i", os.getpid()))
+    recv(sock)  # should be RUN
+    sock.close()
+
+
+def child(sock, request, spec, fds):
+    """
+    returns the exit code of the script
+    """
+    try:
+        cmdline = json.loads(spec)["cmdline"]
+        prepare_child(sock, request, fds)
+    except BaseException:
+        traceback.print_exc()
+        send(sock, ERROR)
+        return 1
+
+    # streams opened as a fresh interpreter would
+    sys.stdin = sys.__stdin__ = open(0, "r", closefd=False)
+    sys.stdout = sys.__stdout__ = open(1, "w", closefd=False)
+    sys.stderr = sys.__stderr__ = open(
+        2, "w", buffering=1, errors="backslashreplace", closefd=False
+    )
+    script = cmdline[1]
+    sys.argv = cmdline[1:]
+    sys.path[0] = os.path.dirname(os.path.abspath(script))
+    return run_script(script)
+
+
+def serve(sock):
+    """
+    returns in forked children only, with their exit code
+    """
+    while True:
+        msg, payload, fds = recv(sock)
+        if msg is None:
+            os._exit(0)
+        if msg != RUN or len(payload) < REQUEST.size:
+            os._exit(1)
+
+        try:
+            pid = os.fork()
+        except OSError:
+            pid = -1
+        if pid == 0:
+            request, spec = payload[: REQUEST.size], payload[REQUEST.size :]
+            return child(sock, request, spec, fds)
+
+        status = 1 << 8
+        if pid == -1:
+            send(sock, ERROR)
+        else:
+            _, status = os.waitpid(pid, 0)
+        for fd in fds:
+            os.close(fd)
+        send(sock, EXITED, struct.pack("=i", status))
+
+
+def main():
+    sock = socket.socket(fileno=int(os.environ.pop("YAMC_SERVER_FD")))
+    # children must not be able to touch the zygote
+    set_dumpable(0)
+    # warm up runpy and import caches once, so that children do not have to
+    # write to (and copy) as many pages
+    runpy.run_path(os.devnull, run_name="__main__")
+    gc.collect()
+    if hasattr(gc, "freeze"):
+        gc.freeze()
+    shutdown(serve(sock))
+
+
+if __name__ == "__main__":
+    main()
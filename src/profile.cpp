@@ -0,0 +1,279 @@
+#include "profile.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+
+#include "sha256.h"
+
+namespace yamc {
+
+static const char stamp_name[] = ".profile";
+static const char lock_name[] = ".lock";
+static const size_t version_len = 16;
+
+// shared locks on the trees this process uses, held until it exits
+static std::vector<int> held_trees;
+
+static std::string readStamp(const fs::path &tree) {
+    std::ifstream in(tree / stamp_name);
+    return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+/**
+ * @brief copy path of the host into tree at the same place, hard linking
+ * files if possible. symlinks are kept and what they point to is copied too.
+ * sockets, devices and the like are left out
+ */
+static void mirror(fs::path path, const fs::path &tree,
+                   std::set<fs::path> &seen) {
+    std::error_code ec;
+    // so that no directory of the tree stands for a symlink of the host,
+    // e.g. /lib for /usr/lib
+    if (path.has_relative_path()) {
+        path = fs::weakly_canonical(path.parent_path(), ec) / path.filename();
+    }
+    if (!seen.insert(path).second) {
+        return;
+    }
+    const auto target = tree / path.lexically_relative("/");
+    const auto st = fs::symlink_status(path, ec);
+    if (fs::is_symlink(st)) {
+        const auto link = fs::read_symlink(path);
+        fs::create_directories(target.parent_path());
+        fs::create_symlink(link, target);
+        mirror(link.is_absolute()
+                   ? link
+                   : (path.parent_path() / link).lexically_normal(),
+               tree, seen);
+    } else if (fs::is_directory(st)) {
+        fs::create_directories(target);
+        for (const auto &entry : fs::directory_iterator(path, ec)) {
+            mirror(entry.path(), tree, seen);
+        }
+        // after its entries, which a read only directory would not take
+        fs::permissions(target, st.permissions());
+    } else if (fs::is_regular_file(st)) {
+        fs::create_directories(target.parent_path());
+        if (link(path.c_str(), target.c_str()) == -1) {
+            // across file systems, or protected_hardlinks
+            fs::copy_file(path, target);
+        }
+    }
+}
+
+/**
+ * @brief hash what mirror() would copy of path, with the identity and mtime
+ * of files and directories, so that a tree is assembled again once files
+ * are replaced on the host, e.g. by package upgrades. ctime is left out, as
+ * hard linking files into a tree changes it. files in directories are not
+ * looked at one by one: replacing one changes the mtime of its directory
+ */
+static void fingerprint(fs::path path, Sha256 &hash, std::set<fs::path> &seen) {
+    std::error_code ec;
+    if (path.has_relative_path()) {
+        path = fs::weakly_canonical(path.parent_path(), ec) / path.filename();
+    }
+    if (!seen.insert(path).second) {
+        return;
+    }
+    hash.update(path.string());
+    struct stat st;
+    if (lstat(path.c_str(), &st) == -1) {
+        return;
+    }
+    const uint64_t id[] = {st.st_mode,
+                           st.st_dev,
+                           st.st_ino,
+                           static_cast<uint64_t>(st.st_size),
+                           static_cast<uint64_t>(st.st_mtim.tv_sec),
+                           static_cast<uint64_t>(st.st_mtim.tv_nsec)};
+    hash.update(id, sizeof(id));
+    if (S_ISLNK(st.st_mode)) {
+        const auto link = fs::read_symlink(path, ec);
+        hash.update(link.string());
+        if (!ec) {
+            fingerprint(link.is_absolute()
+                            ? link
+                            : (path.parent_path() / link).lexically_normal(),
+                        hash, seen);
+        }
+    } else if (S_ISDIR(st.st_mode)) {
+        // in the same order every time
+        std::vector<fs::path> entries;
+        for (const auto &entry : fs::directory_iterator(path, ec)) {
+            // the type is known from the directory, without a stat
+            if (entry.is_symlink(ec) || entry.is_directory(ec)) {
+                entries.push_back(entry.path());
+            }
+        }
+        std::sort(entries.begin(), entries.end());
+        for (const auto &entry : entries) {
+            fingerprint(entry, hash, seen);
+        }
+    }
+}
+
+/**
+ * @brief assemble the tree of a profile described by desc into dest, which
+ * replaces an incomplete tree left there if any
+ */
+static void assemble(const nlohmann::json &desc, const std::string &stamp,
+                     const fs::path &dest) {
+    const auto staging =
+        dest.parent_path() /
+        ("." + dest.filename().string() + "." + std::to_string(getpid()));
+    std::error_code ec;
+    fs::remove_all(staging, ec);
+    try {
+        fs::create_directory(staging);
+        std::set<fs::path> seen;
+        for (const auto &path : desc.at("paths")) {
+            mirror(path.get<std::string>(), staging, seen);
+        }
+        std::ofstream out(staging / stamp_name);
+        if (!(out << stamp).flush()) {
+            throw std::runtime_error("failed to write stamp of " +
+                                     dest.string());
+        }
+    } catch (const std::exception &e) {
+        fs::remove_all(staging, ec);
+        throw;
+    }
+
+    const auto old = staging.string() + ".old";
+    if (fs::exists(dest)) {
+        fs::rename(dest, old);
+    }
+    fs::rename(staging, dest);
+    fs::remove_all(old, ec);
+}
+
+/**
+ * @brief take a shared lock on tree for as long as this process runs, so
+ * that it is not collected under its jails
+ */
+static void holdTree(const fs::path &tree) {
+    const auto lock = tree / lock_name;
+    int fd = open(lock.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1 || flock(fd, LOCK_SH) == -1) {
+        if (fd != -1) close(fd);
+        throw std::runtime_error("failed to lock " + lock.string() + ": " +
+                                 strerror(errno));
+    }
+    held_trees.push_back(fd);
+}
+
+/**
+ * @brief remove the trees of profile name in dir other than keep that no
+ * process holds. called with the lock of the profile held, under which trees
+ * are taken too
+ */
+static void collectTrees(const fs::path &dir, const std::string &name,
+                         const fs::path &keep) {
+    const auto prefix = "." + name + ".";
+    std::error_code ec;
+    std::vector<fs::path> trees;
+    for (const auto &entry : fs::directory_iterator(dir, ec)) {
+        const auto file = entry.path().filename().string();
+        if (entry.path() != keep && !entry.is_symlink(ec) &&
+            entry.is_directory(ec) &&
+            file.size() == prefix.size() + version_len &&
+            file.compare(0, prefix.size(), prefix) == 0 &&
+            file.find_first_not_of("0123456789abcdef", prefix.size()) ==
+                std::string::npos) {
+            trees.push_back(entry.path());
+        }
+    }
+    for (const auto &tree : trees) {
+        int fd = open((tree / lock_name).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd != -1 && flock(fd, LOCK_EX | LOCK_NB) == -1) {
+            close(fd);
+            continue;
+        }
+        LOG(INFO) << "removing unused tree " << tree;
+        fs::remove_all(tree, ec);
+        if (fd != -1) close(fd);
+    }
+}
+
+void useProfile(Config &conf) {
+    if (conf.profile.empty()) {
+        return;
+    }
+    if (conf.profile.find('/') != std::string::npos ||
+        conf.profile[0] == '.') {
+        throw std::runtime_error("invalid profile name " + conf.profile);
+    }
+    const auto desc_path = conf.profile_dir / (conf.profile + ".json");
+    std::ifstream in(desc_path);
+    if (!in) {
+        throw std::runtime_error("no profile " + desc_path.string());
+    }
+    const auto desc = nlohmann::json::parse(in);
+    // a tree is never modified once published: another one is assembled
+    // when the description or the files listed change, so that files
+    // replaced on the host are not kept alive by hard links, and the old
+    // one is removed once no process binds it anymore
+    Sha256 hash;
+    std::set<fs::path> seen;
+    for (const auto &path : desc.at("paths")) {
+        fingerprint(path.get<std::string>(), hash, seen);
+    }
+    const auto stamp = desc.dump() + "\n" + hash.hexdigest() + "\n";
+    const auto version = Sha256().update(stamp).hexdigest();
+    const auto tree = conf.profile_dir / ("." + conf.profile + "." +
+                                          version.substr(0, version_len));
+
+    const auto lock = conf.profile_dir / ("." + conf.profile + ".lock");
+    int lock_fd = open(lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd == -1 || flock(lock_fd, LOCK_EX) == -1) {
+        if (lock_fd != -1) close(lock_fd);
+        throw std::runtime_error("failed to lock " + lock.string() + ": " +
+                                 strerror(errno));
+    }
+    try {
+        // unless another process has assembled it
+        if (readStamp(tree) != stamp) {
+            LOG(INFO) << "assembling profile " << conf.profile;
+            assemble(desc, stamp, tree);
+        }
+        holdTree(tree);
+        collectTrees(conf.profile_dir, conf.profile, tree);
+    } catch (const std::exception &e) {
+        close(lock_fd);
+        throw;
+    }
+    close(lock_fd);
+
+    auto &robind = conf.robind;
+    robind.erase(
+        std::remove_if(robind.begin(), robind.end(),
+                       [](const MountPt &bind) {
+                           const auto &defaults = Config::default_robind;
+                           return std::any_of(
+                               defaults.begin(), defaults.end(),
+                               [&](const MountPt &d) {
+                                   return d.src == bind.src &&
+                                          d.dest == bind.dest;
+                               });
+                       }),
+        robind.end());
+    // before other binds, which may be mounted under them
+    for (const auto &entry : fs::directory_iterator(tree)) {
+        if (entry.is_directory() && !entry.is_symlink()) {
+            const auto dest = "/" / entry.path().filename();
+            DLOG(INFO) << "profile " << conf.profile << " binds " << dest;
+            robind.emplace(robind.begin(), entry.path(), dest, "",
+                           MountPt::MNT_TYPE::ROBIND);
+        }
+    }
+}
+
+}  // namespace yamc
@@ -0,0 +1,27 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "config.h"
+
+namespace yamc {
+
+/**
+ * @brief let jails configured by conf use the rootfs of profile conf.profile
+ * instead of binding the whole userland of the host
+ *
+ * a profile is described by conf.profile_dir/<name>.json, e.g.
+ * {"paths": ["/usr/bin/g++", "/usr/lib/gcc", "/usr/include"]}, listing the
+ * files and directories of the host it needs. they are assembled into
+ * conf.profile_dir/.<name>.<version>, hard linked or copied with symlinks
+ * followed, and the top level directories of the tree, usually only /usr,
+ * replace Config::default_robind, so that the rootfs is a single bind. the
+ * version changes with the description and the files it lists, and trees of
+ * other versions are removed once no process holds them. conf is left as is
+ * if no profile is set
+ *
+ */
+void useProfile(Config &conf);
+
+}  // namespace yamc
+
+#endif  // PROFILE_H_
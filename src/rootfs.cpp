@@ -0,0 +1,281 @@
+#include "rootfs.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <glog/raw_logging.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <map>
+
+#include "utils.h"
+
+namespace yamc {
+
+// templates kept per process, beyond which jails populate their roots
+static const size_t max_templates = 16;
+
+static fs::path workspaceDir(size_t i) {
+    return Config::workspace_mount_point / std::to_string(i);
+}
+
+static pid_t template_owner = 0;  // process whose mount namespace has them
+static bool store_mounted = false;
+static std::map<std::string, fs::path> templates;
+static size_t templates_built = 0;
+
+/**
+ * @brief mask what is at target, a directory by an empty read only tmpfs and
+ * anything else by /dev/null. a missing target or a symlink is left as is,
+ * as nothing is created or followed
+ */
+static void hidePath(const fs::path &target) {
+    struct stat st;
+    if (lstat(target.c_str(), &st) == -1 || S_ISLNK(st.st_mode)) {
+        return;
+    }
+    int ret;
+    if (S_ISDIR(st.st_mode)) {
+        ret = mount("", target.c_str(), "tmpfs",
+                    MS_NODEV | MS_NOEXEC | MS_NOSUID | MS_RDONLY,
+                    "size=4k,mode=555");
+    } else {
+        ret = mount("/dev/null", target.c_str(), "", MS_BIND, "");
+        if (ret == 0) {
+            ret = mount("", target.c_str(), "",
+                        MS_REMOUNT | MS_BIND | MS_RDONLY | MS_NOSUID, "");
+        }
+    }
+    if (ret == -1) {
+        RAW_LOG(ERROR, "failed to hide %s", target.c_str());
+        throw std::runtime_error(strerror(errno));
+    }
+}
+
+void populateRootfs(const Config &conf, const mount_list_t &binds,
+                    const fs::path &root) {
+    for (const auto *list : {&conf.robind, &conf.rwbind, &binds}) {
+        for (const auto &bind : *list) {
+            if (bind.type == MountPt::MNT_TYPE::TMPFS) {
+                const auto target = root / bind.dest.lexically_relative("/");
+                fs::create_directories(target);
+                continue;
+            }
+            RAW_DLOG(INFO, "mounting %s -> %s", bind.src.c_str(),
+                     bind.dest.c_str());
+            mountFs(bind, root, MS_NOSUID);
+        }
+    }
+    // on top of the binds they are in
+    for (const auto &path : conf.hidden) {
+        hidePath(root / path.lexically_relative("/"));
+    }
+    for (const auto &tmp : conf.tmpfs) {
+        fs::create_directories(root / tmp.dest.lexically_relative("/"));
+    }
+    for (size_t i = 0; i < conf.workspace.size(); ++i) {
+        const auto &ws = conf.workspace[i];
+        const auto dir = workspaceDir(i);
+        mountFs({ws.src, dir / "lower", "", MountPt::MNT_TYPE::ROBIND}, root,
+                MS_NOSUID);
+        fs::create_directories(root / (dir / "rw").lexically_relative("/"));
+        fs::create_directories(root / ws.dest.lexically_relative("/"));
+    }
+    for (const auto &link : conf.symlink) {
+        const auto target = root / link.src.lexically_relative("/");
+        fs::create_symlink(link.dest, target);
+    }
+    fs::create_directory(root / "proc");
+}
+
+void mountScratch(const Config &conf, const fs::path &root) {
+    for (const auto *list : {&conf.rwbind, &conf.tmpfs}) {
+        for (const auto &tmp : *list) {
+            if (tmp.type == MountPt::MNT_TYPE::TMPFS) {
+                RAW_DLOG(INFO, "mounting tmpfs %s", tmp.dest.c_str());
+                mountFs(tmp, root, MS_NOSUID);
+            }
+        }
+    }
+
+    const auto proc = root / "proc";
+    if (mount("", proc.c_str(), "proc", MS_NOSUID | MS_NOEXEC | MS_NODEV,
+              "") == -1) {
+        RAW_DLOG(INFO, "failed to mount procfs");
+        throw std::runtime_error(strerror(errno));
+    }
+}
+
+void remountScratch(const Config &conf) {
+    for (const auto *list : {&conf.rwbind, &conf.tmpfs}) {
+        for (const auto &tmp : *list) {
+            if (tmp.type != MountPt::MNT_TYPE::TMPFS) {
+                continue;
+            }
+            // freed once the last process using it is gone
+            if (umount2(tmp.dest.c_str(), MNT_DETACH) == -1) {
+                RAW_LOG(ERROR, "failed to unmount tmpfs %s", tmp.dest.c_str());
+                throw std::runtime_error(strerror(errno));
+            }
+            mountFs(tmp, "/", MS_NOSUID);
+        }
+    }
+}
+
+void mountWorkspaces(const Config &conf) {
+    for (size_t i = 0; i < conf.workspace.size(); ++i) {
+        const auto &ws = conf.workspace[i];
+        const auto dir = workspaceDir(i);
+        const auto rw = dir / "rw";
+        const auto upper = rw / "upper", work = rw / "work";
+        // files of the lower layer keep their owners, so a user other than
+        // root could not modify a workspace that is not its own
+        struct stat st;
+        if (conf.use_uid.inside_id != 0 &&
+            (stat((dir / "lower").c_str(), &st) == -1 ||
+             st.st_uid != conf.use_uid.inside_id)) {
+            RAW_LOG(ERROR, "workspace %s is not owned by the user",
+                    ws.src.c_str());
+            throw std::runtime_error("workspace " + ws.src.string() +
+                                     " is not owned by the user");
+        }
+        if (mount("", rw.c_str(), "tmpfs", MS_NOSUID | MS_NODEV,
+                  ws.option.c_str()) == -1) {
+            RAW_LOG(ERROR, "failed to mount tmpfs for workspace %s",
+                    ws.dest.c_str());
+            throw std::runtime_error(strerror(errno));
+        }
+        // the root of the workspace is that of the upper layer
+        if (mkdir(upper.c_str(), 0755) == -1 ||
+            mkdir(work.c_str(), 0755) == -1 ||
+            chown(upper.c_str(), conf.use_uid.inside_id,
+                  conf.use_gid.inside_id) == -1) {
+            throw std::runtime_error(strerror(errno));
+        }
+        const auto option = "lowerdir=" + (dir / "lower").string() +
+                            ",upperdir=" + upper.string() +
+                            ",workdir=" + work.string();
+        if (mount("overlay", ws.dest.c_str(), "overlay", MS_NOSUID | MS_NODEV,
+                  option.c_str()) == -1) {
+            RAW_LOG(ERROR, "failed to mount workspace %s", ws.dest.c_str());
+            throw std::runtime_error(strerror(errno));
+        }
+    }
+}
+
+void dropWorkspaces(const Config &conf) {
+    for (size_t i = conf.workspace.size(); i-- > 0;) {
+        umount2(conf.workspace[i].dest.c_str(), MNT_DETACH);
+        umount2((workspaceDir(i) / "rw").c_str(), MNT_DETACH);
+    }
+}
+
+static std::string templateKey(const Config &conf, const mount_list_t &binds) {
+    nlohmann::json key = nlohmann::json::array();
+    for (const auto *list :
+         {&conf.robind, &conf.rwbind, &conf.tmpfs, &conf.workspace, &binds}) {
+        for (const auto &m : *list) {
+            key.push_back({m.src.string(), m.dest.string(), (int)m.type});
+        }
+        key.push_back(nullptr);
+    }
+    for (const auto &link : conf.symlink) {
+        key.push_back({link.src.string(), link.dest.string()});
+    }
+    key.push_back(nullptr);
+    for (const auto &path : conf.hidden) {
+        key.push_back(path.string());
+    }
+    return key.dump();
+}
+
+fs::path rootfsTemplate(const Config &conf, const mount_list_t &binds) {
+    // ENOSYS before linux 5.2, EBADF otherwise
+    static const bool supported =
+        syscall(SYS_open_tree, -1, "", 0) == -1 && errno != ENOSYS;
+    if (!supported) {
+        return {};
+    }
+
+    const auto key = templateKey(conf, binds);
+    auto it = templates.find(key);
+    if (it != templates.end()) {
+        return it->second;
+    }
+    if (templates.size() >= max_templates) {
+        return {};
+    }
+
+    try {
+        if (template_owner != getpid()) {
+            // the mount namespace may be the host's or shared with the
+            // process we are forked from
+            if (unshare(CLONE_NEWNS) == -1) {
+                throw std::runtime_error(
+                    std::string("failed to unshare mount namespace: ") +
+                    strerror(errno));
+            }
+            template_owner = getpid();
+        }
+        if (!store_mounted) {
+            if (mount("", conf.chroot_path.c_str(), "tmpfs",
+                      MS_NOSUID | MS_NODEV | MS_NOEXEC, "mode=700") == -1 ||
+                mount(nullptr, conf.chroot_path.c_str(), nullptr,
+                      MS_PRIVATE | MS_REC, nullptr) == -1) {
+                throw std::runtime_error(
+                    std::string("failed to mount template store: ") +
+                    strerror(errno));
+            }
+            store_mounted = true;
+        }
+
+        // the store is shared with processes forked off after it is mounted
+        const auto path =
+            conf.chroot_path / (std::to_string(getpid()) + "." +
+                                std::to_string(templates_built++));
+        fs::create_directory(path);
+        if (mount("", path.c_str(), "tmpfs", 0, "size=16777216") == -1) {
+            throw std::runtime_error(std::string("failed to mount tmpfs: ") +
+                                     strerror(errno));
+        }
+        populateRootfs(conf, binds, path);
+        DLOG(INFO) << "built mount template " << path;
+        templates.emplace(key, path);
+        return path;
+    } catch (const std::exception &e) {
+        LOG(ERROR) << "failed to build mount template: " << e.what();
+        return {};
+    }
+}
+
+void cloneRootfs(const fs::path &tmpl, const fs::path &target) {
+    int tree = syscall(SYS_open_tree, AT_FDCWD, tmpl.c_str(),
+                       OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+    if (tree == -1) {
+        RAW_LOG(ERROR, "failed to clone mount template %s", tmpl.c_str());
+        throw std::runtime_error(strerror(errno));
+    }
+    if (syscall(SYS_move_mount, tree, "", AT_FDCWD, target.c_str(),
+                MOVE_MOUNT_F_EMPTY_PATH) == -1) {
+        close(tree);
+        RAW_LOG(ERROR, "failed to move mount template to %s", target.c_str());
+        throw std::runtime_error(strerror(errno));
+    }
+    close(tree);
+}
+
+void dropRootfsTemplates(const Config &conf) {
+    if (template_owner != getpid() || !store_mounted) {
+        return;
+    }
+    if (umount2(conf.chroot_path.c_str(), MNT_DETACH) == -1) {
+        LOG(ERROR) << "failed to unmount templates: " << strerror(errno);
+    }
+    store_mounted = false;
+    templates.clear();
+}
+
+}  // namespace yamc
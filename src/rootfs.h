@@ -0,0 +1,68 @@
+#ifndef ROOTFS_H_
+#define ROOTFS_H_
+
+#include "config.h"
+
+namespace yamc {
+
+/**
+ * root of a jail. binds, symlinks and mount points are built once per
+ * process and configuration into a template, mounted in a mount namespace of
+ * the process's own, which jails clone with open_tree and move_mount instead
+ * of mounting every bind. tmpfs and procfs are still mounted by every jail, as
+ * they are not to be shared
+ */
+
+/**
+ * @brief bind, symlink and create the mount points of the root of a jail
+ * configured by conf under root, binds being extra binds of the jail, and
+ * mask conf.hidden
+ */
+void populateRootfs(const Config &conf, const mount_list_t &binds,
+                    const fs::path &root);
+
+/**
+ * @brief mount the tmpfs and procfs of a jail configured by conf under root,
+ * populated by populateRootfs
+ */
+void mountScratch(const Config &conf, const fs::path &root);
+
+/**
+ * @brief replace the tmpfs mounted by mountScratch in the current root with
+ * empty ones, so that files left there by an execution are gone before the
+ * next one
+ */
+void remountScratch(const Config &conf);
+
+/**
+ * @brief mount the workspaces of conf, overlays of their sources with an
+ * empty tmpfs as the upper layer, in a jail populated by populateRootfs
+ */
+void mountWorkspaces(const Config &conf);
+
+/**
+ * @brief unmount the workspaces, discarding whatever was written to them
+ */
+void dropWorkspaces(const Config &conf);
+
+/**
+ * @brief path of the template for conf and binds, built if there is none.
+ * empty if templates are not available, e.g. before linux 5.2, in which case
+ * jails populate their roots themselves
+ */
+fs::path rootfsTemplate(const Config &conf, const mount_list_t &binds);
+
+/**
+ * @brief mount a clone of the template onto target
+ */
+void cloneRootfs(const fs::path &tmpl, const fs::path &target);
+
+/**
+ * @brief unmount templates built by this process, so that conf.chroot_path
+ * can be removed
+ */
+void dropRootfsTemplates(const Config &conf);
+
+}  // namespace yamc
+
+#endif  // ROOTFS_H_
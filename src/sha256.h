@@ -0,0 +1,45 @@
+#ifndef SHA256_H_
+#define SHA256_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace yamc {
+
+/**
+ * sha-256 as in FIPS 180-4, for keys of content addressed caches that must
+ * not collide even for crafted input
+ */
+class Sha256 {
+   private:
+    uint32_t state_[8];
+    uint8_t block_[64];
+    size_t block_len_;
+    uint64_t total_len_;
+
+    void compress_(const uint8_t *block);
+
+   public:
+    Sha256();
+
+    Sha256 &update(const void *data, size_t len);
+
+    /**
+     * @brief feed str along with its terminating null, so that a sequence of
+     * strings can not be confused with another one of the same concatenation
+     *
+     */
+    Sha256 &update(const std::string &str);
+
+    /**
+     * @brief finish and return the digest in lower case hex. the object must
+     * not be updated afterwards
+     *
+     */
+    std::string hexdigest();
+};
+
+}  // namespace yamc
+
+#endif  // SHA256_H_
@@ -0,0 +1,175 @@
+#include "stream.h"
+
+#include <glog/logging.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+namespace yamc {
+
+static const size_t pipe_size = 1024 * 1024;
+
+static bool isSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+OutputHash::OutputHash(const nlohmann::json &desc)
+    : mode_(MODE::TOKENS),
+      space_(false),
+      started_(false),
+      newlines_(0) {
+    static const std::pair<const char *, MODE> modes[] = {
+        {"exact", MODE::EXACT},
+        {"tokens", MODE::TOKENS},
+        {"lines", MODE::LINES},
+    };
+    if (!desc.is_object()) {
+        throw std::runtime_error("invalid hash");
+    }
+    if (desc.contains("mode")) {
+        const auto mode = desc.at("mode").get<std::string>();
+        auto it = std::find_if(std::begin(modes), std::end(modes),
+                               [&](const auto &m) { return mode == m.first; });
+        if (it == std::end(modes)) {
+            throw std::runtime_error("unknown hash mode " + mode);
+        }
+        mode_ = it->second;
+    }
+    if (desc.contains("expect")) {
+        expect_ = desc.at("expect").get<std::string>();
+    }
+}
+
+void OutputHash::feed(const char *buf, size_t len) {
+    if (mode_ == MODE::EXACT) {
+        hash_.update(buf, len);
+        return;
+    }
+    normalized_.clear();
+    for (size_t i = 0; i < len; ++i) {
+        char c = buf[i];
+        if (mode_ == MODE::TOKENS) {
+            if (isSpace(c)) {
+                space_ = started_;
+                continue;
+            }
+            if (space_) {
+                normalized_.push_back(' ');
+                space_ = false;
+            }
+            started_ = true;
+        } else {
+            if (c == '\n') {
+                blank_.clear();
+                ++newlines_;
+                continue;
+            }
+            if (isSpace(c)) {
+                blank_.push_back(c);
+                continue;
+            }
+            normalized_.append(newlines_, '\n');
+            normalized_ += blank_;
+            newlines_ = 0;
+            blank_.clear();
+        }
+        normalized_.push_back(c);
+    }
+    hash_.update(normalized_.data(), normalized_.size());
+}
+
+nlohmann::json OutputHash::digest(size_t bytes) const {
+    nlohmann::json res{{"xxh64", hash_.hexdigest()}, {"bytes", bytes}};
+    if (!expect_.empty()) {
+        bool same = res.at("xxh64") == expect_;
+        res["verdict"] = same ? "ok" : "wa";
+        res["score"] = same ? 1 : 0;
+    }
+    return res;
+}
+
+CapturedOutput::CapturedOutput(const Config &conf)
+    : tee_fd_(conf.stdout_fd == Config::NO_IO_REDIRECT ? -1 : conf.stdout_fd),
+      limit_(conf.output_limit),
+      size_(0),
+      killed_(false) {
+    int fds[2];
+    makePipe(fds, pipe_size);
+    read_fd_ = fds[0];
+    write_fd_ = fds[1];
+}
+
+void CapturedOutput::compare(const Comparator &comparator,
+                             const fs::path &answer) {
+    comparison_ = std::make_unique<StreamComparison>(comparator, answer);
+}
+
+void CapturedOutput::hash(const nlohmann::json &desc) {
+    hash_ = std::make_unique<OutputHash>(desc);
+}
+
+Config CapturedOutput::redirect(Config conf) const {
+    conf.stdout_fd = write_fd_;
+    return conf;
+}
+
+void CapturedOutput::pump(Jail &jail) {
+    // only the jailed process may keep the write end open, or there is no
+    // EOF
+    close(write_fd_);
+    write_fd_ = -1;
+
+    static const size_t buf_sz = 64 * 1024;
+    std::unique_ptr<char[]> buf{new char[buf_sz]};
+    for (;;) {
+        ssize_t sz = TEMP_FAILURE_RETRY(read(read_fd_, buf.get(), buf_sz));
+        if (sz < 0) {
+            throw std::runtime_error(std::string("failed to read output: ") +
+                                     strerror(errno));
+        }
+        if (sz == 0) {
+            return;
+        }
+        // the file gets no more than the limit, like a file redirected to
+        size_t kept = size_ < limit_ ? std::min<size_t>(sz, limit_ - size_)
+                                     : 0;
+        size_ += sz;
+        if (tee_fd_ != -1 && !writeToFd(tee_fd_, buf.get(), kept)) {
+            throw std::runtime_error(std::string("failed to write output: ") +
+                                     strerror(errno));
+        }
+        if (hash_) {
+            hash_->feed(buf.get(), sz);
+        }
+        if (size_ > limit_ ||
+            (comparison_ && !comparison_->feed(buf.get(), sz))) {
+            DLOG(INFO) << "killing the execution at byte " << size_;
+            jail.killJailed();
+            killed_ = true;
+            return;
+        }
+    }
+}
+
+nlohmann::json CapturedOutput::report(nlohmann::json &res) {
+    nlohmann::json verdicts = nlohmann::json::object();
+    if (size_ > limit_) {
+        res["signal"] = SIGXFSZ;
+        return verdicts;
+    }
+    bool succeeded = res.at("returnCode") == 0 && res.at("signal") == 0;
+    if (comparison_ && (succeeded || killed_)) {
+        verdicts["compare"] = comparison_->finish();
+    }
+    if (hash_ && succeeded) {
+        verdicts["hash"] = hash_->digest(size_);
+    }
+    return verdicts;
+}
+
+CapturedOutput::~CapturedOutput() {
+    for (auto fd : {read_fd_, write_fd_}) {
+        if (fd != -1) close(fd);
+    }
+}
+
+}  // namespace yamc
@@ -0,0 +1,110 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include "compare.h"
+#include "jail.h"
+#include "xxh64.h"
+
+namespace yamc {
+
+/**
+ * xxh64 of an output fed chunk by chunk, normalized as the comparator would
+ * see it, so that it can be checked against the hash of the answer alone
+ *  - exact: the output as is
+ *  - tokens: whitespace separated tokens joined by single spaces
+ *  - lines: lines with trailing whitespace stripped, joined by newlines,
+ *    without trailing empty lines
+ */
+class OutputHash {
+   public:
+    enum class MODE { EXACT, TOKENS, LINES };
+
+   private:
+    MODE mode_;
+    std::string expect_;  // hex digest expected, if any
+    Xxh64 hash_;
+    std::string normalized_;
+    // whitespace held back until it is known to be followed by more
+    bool space_, started_;
+    std::string blank_;
+    size_t newlines_;
+
+   public:
+    OutputHash() = delete;
+
+    /**
+     * @brief desc is {"mode": "exact" | "tokens" | "lines", "expect": hex},
+     * mode defaulting to tokens
+     */
+    explicit OutputHash(const nlohmann::json &desc);
+
+    void feed(const char *buf, size_t len);
+
+    /**
+     * @return {"xxh64": hex, "bytes": bytes}, with "verdict" "ok" or "wa"
+     * and "score" if a digest is expected
+     */
+    nlohmann::json digest(size_t bytes) const;
+};
+
+/**
+ * stdout of an execution captured through a pipe, to be compared with the
+ * answer or hashed while it is produced. a comparison kills the execution at
+ * the first difference instead of letting it run on until the time limit.
+ * the output is still written to the file stdout was redirected to, if any
+ *
+ * create it after the jail is prepared, or the jail inherits the pipe
+ */
+class CapturedOutput {
+   private:
+    std::unique_ptr<StreamComparison> comparison_;
+    std::unique_ptr<OutputHash> hash_;
+    int read_fd_, write_fd_;
+    int tee_fd_;  // file the output is also written to, -1 if none
+    size_t limit_, size_;
+    bool killed_;
+
+   public:
+    CapturedOutput() = delete;
+    CapturedOutput(CapturedOutput const &) = delete;
+    CapturedOutput &operator=(CapturedOutput const &) = delete;
+
+    /**
+     * @brief capture stdout of conf, which is limited to conf.output_limit
+     * bytes as if it were a file
+     */
+    explicit CapturedOutput(const Config &conf);
+
+    void compare(const Comparator &comparator, const fs::path &answer);
+
+    /**
+     * @brief hash the output, see OutputHash
+     */
+    void hash(const nlohmann::json &desc);
+
+    /**
+     * @brief conf with stdout redirected into the pipe
+     */
+    Config redirect(Config conf) const;
+
+    /**
+     * @brief read the output of the execution started in jail with
+     * redirect() until EOF. the execution is killed at the first difference
+     * or once it exceeds the limit, and the rest of its output is discarded
+     */
+    void pump(Jail &jail);
+
+    /**
+     * @brief verdicts once the execution is waited for, res being its
+     * result. {"compare": ..., "hash": ...} as enabled, each left out if the
+     * execution failed before it is known. the signal of an execution killed
+     * for exceeding the limit is set to SIGXFSZ
+     */
+    nlohmann::json report(nlohmann::json &res);
+
+    ~CapturedOutput();
+};
+
+}  // namespace yamc
+
+#endif  // STREAM_H_
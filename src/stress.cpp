@@ -0,0 +1,241 @@
+#include "stress.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "compare.h"
+#include "jail.h"
+#include "job.h"
+#include "utils.h"
+
+namespace yamc {
+
+static bool succeeded(const Result &res) {
+    return res.return_code == 0 && res.signal == 0;
+}
+
+static int createMemfd(const char *name) {
+    int fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error(std::string("failed to call memfd_create: ") +
+                                 strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * empty a memfd shared with a jailed process as stdout, so that it writes
+ * from the beginning again
+ */
+static void truncateMemfd(int fd) {
+    if (ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+        throw std::runtime_error(std::string("failed to rewind memfd: ") +
+                                 strerror(errno));
+    }
+}
+
+/**
+ * a new open file description of fd, so that readers of the same memfd do
+ * not share the offset
+ */
+static int reopen(int fd) {
+    const auto path = "/proc/self/fd/" + std::to_string(fd);
+    int new_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (new_fd == -1) {
+        throw std::runtime_error(std::string("failed to reopen memfd: ") +
+                                 strerror(errno));
+    }
+    return new_fd;
+}
+
+static std::string readMemfd(int fd) {
+    std::string content;
+    static const size_t buf_sz = 64 * 1024;
+    char buf[buf_sz];
+    ssize_t sz;
+    for (off_t off = 0; (sz = pread(fd, buf, buf_sz, off)) > 0; off += sz) {
+        content.append(buf, sz);
+    }
+    if (sz < 0) {
+        throw std::runtime_error(std::string("failed to read memfd: ") +
+                                 strerror(errno));
+    }
+    return content;
+}
+
+class Stress {
+   private:
+    const Config &base_;
+    nlohmann::json generate_;
+    std::unique_ptr<Job> brute_, run_;
+    Comparator comparator_;
+    // jails of generator, brute and run, prepared once for all iterations
+    std::unique_ptr<Jail> generator_jail_, brute_jail_, run_jail_;
+    int input_fd_, answer_fd_, output_fd_, null_fd_;
+
+    /**
+     * @brief run job with stdin and stdout redirected, in jail
+     */
+    static void start_(Jail &jail, const Job &job, int stdin_fd,
+                       int stdout_fd) {
+        Config conf = job.conf();
+        conf.stdin_fd = stdin_fd;
+        conf.stdout_fd = stdout_fd;
+        jail.start(conf);
+    }
+
+   public:
+    Stress(const Config &base, const nlohmann::json &spec)
+        : base_(base),
+          generate_(spec.at("generate")),
+          brute_(std::make_unique<Job>(base, spec.at("brute"))),
+          run_(std::make_unique<Job>(base, spec.at("run"))),
+          comparator_(spec.value("compare", nlohmann::json::object())),
+          input_fd_(-1),
+          answer_fd_(-1),
+          output_fd_(-1),
+          null_fd_(-1) {
+        // namespaces and mounts are prepared in the background. one after
+        // another, so that a jail process only inherits sockets of jails
+        // created before, which are torn down after it
+        for (auto jail : {&generator_jail_, &brute_jail_, &run_jail_}) {
+            *jail = std::make_unique<Jail>(base);
+            (*jail)->prepare();
+        }
+        try {
+            input_fd_ = createMemfd("yamc-input");
+            answer_fd_ = createMemfd("yamc-answer");
+            output_fd_ = createMemfd("yamc-output");
+            null_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (null_fd_ == -1) {
+                throw std::runtime_error(std::string("failed to open: ") +
+                                         strerror(errno));
+            }
+        } catch (const std::exception &e) {
+            for (auto fd : {input_fd_, answer_fd_, output_fd_, null_fd_}) {
+                close(fd);
+            }
+            throw;
+        }
+    }
+
+    ~Stress() {
+        for (auto fd : {input_fd_, answer_fd_, output_fd_, null_fd_}) {
+            close(fd);
+        }
+    }
+
+    /**
+     * @brief run a single iteration with seed. return true if run passes,
+     * otherwise results of all stages are left in record
+     */
+    bool iterate(unsigned long seed, nlohmann::json &record) {
+        auto generate = generate_;
+        generate["cmdline"].push_back(std::to_string(seed));
+        Job generating{base_, generate};
+        for (auto fd : {input_fd_, answer_fd_, output_fd_}) truncateMemfd(fd);
+        start_(*generator_jail_, generating, null_fd_, input_fd_);
+        auto gen_res = generator_jail_->wait();
+        if (!succeeded(gen_res)) {
+            record["generator"] = gen_res.to_json();
+            throw std::runtime_error("generator failed with seed " +
+                                     std::to_string(seed));
+        }
+
+        // brute and run go in parallel, each reading the input on its own
+        int brute_in = reopen(input_fd_), run_in = -1;
+        Result brute_res, run_res;
+        try {
+            run_in = reopen(input_fd_);
+            start_(*brute_jail_, *brute_, brute_in, answer_fd_);
+            start_(*run_jail_, *run_, run_in, output_fd_);
+            brute_res = brute_jail_->wait();
+            run_res = run_jail_->wait();
+        } catch (const std::exception &e) {
+            close(brute_in);
+            close(run_in);
+            throw;
+        }
+        close(brute_in);
+        close(run_in);
+
+        if (!succeeded(brute_res)) {
+            record["brute"] = brute_res.to_json();
+            throw std::runtime_error("brute failed with seed " +
+                                     std::to_string(seed));
+        }
+        if (succeeded(run_res)) {
+            auto compare = comparator_.compare(output_fd_, answer_fd_);
+            if (compare.at("verdict") == "ok") {
+                return true;
+            }
+            record["compare"] = compare;
+        }
+        record["seed"] = seed;
+        record["generator"] = gen_res.to_json();
+        record["brute"] = brute_res.to_json();
+        record["run"] = run_res.to_json();
+        return false;
+    }
+
+    /**
+     * @brief save the input of the last iteration as path
+     */
+    void saveInput(const fs::path &path) const {
+        const auto &input = readMemfd(input_fd_);
+        // the path is writable by jails
+        int fd = openOutputFile(path);
+        if (!writeToFd(fd, input.data(), input.size())) {
+            auto err = errno;
+            close(fd);
+            throw std::runtime_error("failed to save input to " +
+                                     path.string() + ": " + strerror(err));
+        }
+        close(fd);
+    }
+};
+
+void runStress(int in_fd, int out_fd, const Config &base) {
+    nlohmann::json record;
+    try {
+        const auto spec = nlohmann::json::parse(readAllFromFd(in_fd));
+        for (auto key : {"generate", "brute", "run", "save"}) {
+            if (!spec.contains(key)) {
+                throw std::runtime_error(std::string(key) + " is required");
+            }
+        }
+        // resolved up front to fail early
+        Config conf = base;
+        conf.chdir_path =
+            spec.at("run").value("chdir", base.chdir_path.string());
+        const auto save = hostPath(conf, spec.at("save").get<std::string>());
+        if (save.empty()) {
+            throw std::runtime_error("save is not reachable from host");
+        }
+        const auto first = spec.value("seed", 1UL);
+        const auto count = spec.value("count", 1000UL);
+
+        Stress stress{base, spec};
+        unsigned long i = 0;
+        bool mismatch = false;
+        while (i < count && !mismatch) {
+            mismatch = !stress.iterate(first + i++, record);
+        }
+        if (mismatch) {
+            stress.saveInput(save);
+        }
+        record["iterations"] = i;
+        record["mismatch"] = mismatch;
+    } catch (const std::exception &e) {
+        LOG(ERROR) << "failed to stress: " << e.what();
+        record["error"] = e.what();
+    }
+    const auto &s = dumpLine(record);
+    if (!writeToFd(out_fd, s.c_str(), s.length())) {
+        LOG(ERROR) << "failed to write result: " << strerror(errno);
+    }
+}
+
+}  // namespace yamc
@@ -0,0 +1,33 @@
+#ifndef STRESS_H_
+#define STRESS_H_
+
+#include "config.h"
+
+namespace yamc {
+
+/**
+ * @brief look for a counterexample as described by the json object read
+ * from in_fd until EOF, e.g.
+ * {"generate": {"cmdline": ["./gen"]}, "brute": {"cmdline": ["./brute"]},
+ *  "run": {"cmdline": ["./a.out"]}, "seed": 1, "count": 10000,
+ *  "save": "failed.in"}
+ *
+ * the stages are jobs (see job.h). for every seed from "seed" on, the
+ * generator is run with the seed appended to its cmdline, then its output is
+ * fed to both brute and run, whose outputs are compared token by token, or
+ * as given by "compare" (see compare.h) with the output of brute as the
+ * answer. each stage stays in a jail of its own for the whole loop, and data
+ * is passed through memfds only
+ *
+ * stops at the first seed for which run fails or its output differs, and
+ * saves the input as "save", a path seen inside the jail relative to the
+ * chdir of run. a single json line is written to out_fd at the end,
+ * {"iterations": n, "mismatch": bool}, with the seed and results of all
+ * stages if a mismatch is found
+ *
+ */
+void runStress(int in_fd, int out_fd, const Config &base);
+
+}  // namespace yamc
+
+#endif  // STRESS_H_
@@ -0,0 +1,316 @@
+#include "userns.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+namespace yamc {
+
+typedef std::vector<IDMap> idmap_t;
+
+static const int keeper_stack_size = 8 * 1024;
+
+static void idMaps(const Config &conf, idmap_t &uidmap, idmap_t &gidmap) {
+    auto ruid = getuid();
+    auto rgid = getgid();
+    uidmap = {{0, ruid, 1}};
+    gidmap = {{0, rgid, 1}};
+
+    // additional id map
+    const auto &uu = conf.use_uid;
+    const auto &ug = conf.use_gid;
+    if (uu.outside_id != ruid) {
+        uidmap.emplace_back(uu.inside_id, uu.outside_id, uu.count);
+    }
+    if (ug.outside_id != rgid) {
+        gidmap.emplace_back(ug.inside_id, ug.outside_id, ug.count);
+    }
+}
+
+static nlohmann::json mapsToJson(const idmap_t &uidmap,
+                                 const idmap_t &gidmap) {
+    nlohmann::json res{{"uid", nlohmann::json::array()},
+                       {"gid", nlohmann::json::array()}};
+    for (const auto &m : uidmap) {
+        res["uid"].push_back({m.inside_id, m.outside_id, m.count});
+    }
+    for (const auto &m : gidmap) {
+        res["gid"].push_back({m.inside_id, m.outside_id, m.count});
+    }
+    return res;
+}
+
+static pid_t execIdMap(const std::string &helper, pid_t pid,
+                       const idmap_t &idmap) {
+    std::vector<std::string> cmd;
+    cmd.emplace_back(helper);
+    cmd.emplace_back(std::to_string(pid));
+    for (const auto &m : idmap) {
+        cmd.emplace_back(std::to_string(m.inside_id));
+        cmd.emplace_back(std::to_string(m.outside_id));
+        cmd.emplace_back(std::to_string(m.count));
+    }
+    return systemExec(cmd);
+}
+
+/**
+ * @brief whether the id maps map nothing but root to the caller, which the
+ * caller may write on its own
+ */
+static bool ownIdsOnly(const idmap_t &uidmap, const idmap_t &gidmap) {
+    return uidmap.size() == 1 && gidmap.size() == 1;
+}
+
+/**
+ * @brief write maps of the caller's own ids to the user namespace of the
+ * process proc refers to. gid_map is writable only once setgroups is denied,
+ * which the jail calls with extra gids only
+ */
+static void writeIdMaps(const fs::path &proc, const idmap_t &uidmap,
+                        const idmap_t &gidmap) {
+    static const auto line = [](const IDMap &m) {
+        return std::to_string(m.inside_id) + " " +
+               std::to_string(m.outside_id) + " " + std::to_string(m.count) +
+               "\n";
+    };
+    static const char deny[] = "deny";
+    const auto uid_line = line(uidmap.front());
+    const auto gid_line = line(gidmap.front());
+    if (!writeBufToFile(proc / "setgroups", deny, strlen(deny)) ||
+        !writeBufToFile(proc / "uid_map", uid_line.c_str(),
+                        uid_line.length()) ||
+        !writeBufToFile(proc / "gid_map", gid_line.c_str(),
+                        gid_line.length())) {
+        LOG(ERROR) << "failed to write id maps";
+        throw std::runtime_error(strerror(errno));
+    }
+}
+
+/**
+ * @brief map ids in the user namespace of pid, from here if only the
+ * caller's own ids are mapped, or with new{u,g}idmap run in parallel
+ */
+static void mapIds(pid_t pid, const idmap_t &uidmap, const idmap_t &gidmap) {
+    if (ownIdsOnly(uidmap, gidmap)) {
+        writeIdMaps(fs::path("/proc") / std::to_string(pid), uidmap, gidmap);
+        return;
+    }
+    auto uid_wkr = execIdMap("/usr/bin/newuidmap", pid, uidmap);
+    auto gid_wkr = execIdMap("/usr/bin/newgidmap", pid, gidmap);
+    int uid_wkrsta, gid_wkrsta;
+    if (waitpid(uid_wkr, &uid_wkrsta, 0) == -1 ||
+        waitpid(gid_wkr, &gid_wkrsta, 0) == -1) {
+        LOG(ERROR) << "failed to wait {u,g}id worker process";
+        throw std::runtime_error(strerror(errno));
+    }
+    if ((!WIFEXITED(uid_wkrsta) || WEXITSTATUS(uid_wkrsta) != 0) ||
+        (!WIFEXITED(gid_wkrsta) || WEXITSTATUS(gid_wkrsta) != 0)) {
+        throw std::runtime_error("newidmap unexpectedly exited");
+    }
+}
+
+/**
+ * @brief body of the process owning a new user namespace. one that outlives
+ * us leaves our session and closes every fd, so that it holds neither pipes
+ * nor the lock of the pin file. the last fd closed is the write end of the
+ * pipe passed in, telling the caller it is done
+ */
+static int keepNS(void *arg) {
+    int done_fd = *(int *)arg;
+    if (done_fd != -1) {
+        setsid();
+        int null_fd = open("/dev/null", O_RDWR);
+        for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; ++fd) {
+            dup2(null_fd, fd);
+        }
+        if (syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, 0) == -1) {
+            for (int fd = STDERR_FILENO + 1; fd < getdtablesize(); ++fd) {
+                close(fd);
+            }
+        }
+    }
+    for (;;) {
+        pause();
+    }
+    return 0;
+}
+
+/**
+ * @brief create a user namespace with the id maps, owned by a process that
+ * keeps it alive until killed
+ *
+ * @param detach whether the process is to outlive us
+ * @return pid of the process
+ */
+static pid_t createUserNS(const idmap_t &uidmap, const idmap_t &gidmap,
+                          bool detach) {
+    int done[2] = {-1, -1};
+    if (detach && pipe2(done, O_CLOEXEC) == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+    uint8_t *stack =
+        (uint8_t *)mmap(nullptr, keeper_stack_size, PROT_WRITE | PROT_READ,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    auto keeper = clone(keepNS, stack + keeper_stack_size, CLONE_NEWUSER,
+                        &done[1]);
+    int clone_errno = errno;
+    munmap(stack, keeper_stack_size);
+    if (detach) {
+        close(done[1]);
+    }
+    if (keeper == -1) {
+        if (detach) close(done[0]);
+        LOG(ERROR) << "failed to call clone";
+        throw std::runtime_error(strerror(clone_errno));
+    }
+    if (detach) {
+        char c;
+        readFromFd(done[0], &c, 1);
+        close(done[0]);
+    }
+
+    try {
+        mapIds(keeper, uidmap, gidmap);
+    } catch (const std::exception &e) {
+        kill(keeper, SIGKILL);
+        waitpid(keeper, nullptr, __WALL);
+        throw;
+    }
+    return keeper;
+}
+
+static void killKeeper(pid_t keeper) {
+    int status;
+    if (kill(keeper, SIGKILL) == -1 ||
+        waitpid(keeper, &status, __WALL) != keeper) {
+        throw std::runtime_error("failed to kill a dummy process");
+    }
+}
+
+static int openNS(pid_t keeper) {
+    auto path = fs::path("/proc") / std::to_string(keeper) / "ns" / "user";
+    return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * @brief join the namespace recorded in the pin file if it is alive and has
+ * the id maps, or replace the record with a new one
+ */
+static void joinPinnedNS(const fs::path &pin, const nlohmann::json &maps,
+                         const idmap_t &uidmap, const idmap_t &gidmap) {
+    int pin_fd = open(pin.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (pin_fd == -1 || flock(pin_fd, LOCK_EX) == -1) {
+        if (pin_fd != -1) close(pin_fd);
+        throw std::runtime_error("failed to lock " + pin.string() + ": " +
+                                 strerror(errno));
+    }
+    try {
+        const auto record =
+            nlohmann::json::parse(readAllFromFd(pin_fd), nullptr, false);
+        int ns_fd = -1;
+        if (record.is_object() && record.contains("pid")) {
+            ns_fd = openNS(record.at("pid").get<pid_t>());
+        }
+        struct stat st;
+        // the pid may have been reused, the identity of the namespace not
+        if (ns_fd != -1 &&
+            (fstat(ns_fd, &st) == -1 || st.st_ino != record.at("ino") ||
+             st.st_dev != record.at("dev"))) {
+            close(ns_fd);
+            ns_fd = -1;
+        }
+        if (ns_fd != -1 && record.at("maps") == maps) {
+            DLOG(INFO) << "joining user namespace kept by "
+                       << record.at("pid");
+            int ret = setns(ns_fd, CLONE_NEWUSER);
+            close(ns_fd);
+            if (ret == -1) {
+                throw std::runtime_error(strerror(errno));
+            }
+            close(pin_fd);
+            return;
+        }
+        if (ns_fd != -1) {
+            // kept with other id maps
+            close(ns_fd);
+            kill(record.at("pid").get<pid_t>(), SIGKILL);
+        }
+
+        auto keeper = createUserNS(uidmap, gidmap, true);
+        ns_fd = openNS(keeper);
+        if (ns_fd == -1 || fstat(ns_fd, &st) == -1) {
+            int saved_errno = errno;
+            if (ns_fd != -1) close(ns_fd);
+            killKeeper(keeper);
+            throw std::runtime_error(strerror(saved_errno));
+        }
+        const auto s = nlohmann::json{{"pid", keeper},
+                                      {"ino", st.st_ino},
+                                      {"dev", st.st_dev},
+                                      {"maps", maps}}
+                           .dump();
+        int ret = setns(ns_fd, CLONE_NEWUSER);
+        int saved_errno = errno;
+        close(ns_fd);
+        if (ret == -1) {
+            killKeeper(keeper);
+            throw std::runtime_error(strerror(saved_errno));
+        }
+        if (ftruncate(pin_fd, 0) == -1 ||
+            pwrite(pin_fd, s.c_str(), s.length(), 0) != (ssize_t)s.length()) {
+            // no later run would find or kill it. being in the namespace, we
+            // keep it alive for this run on our own
+            LOG(ERROR) << "failed to record the user namespace in " << pin;
+            killKeeper(keeper);
+            close(pin_fd);
+            return;
+        }
+        DLOG(INFO) << "user namespace kept by " << keeper;
+    } catch (const std::exception &e) {
+        close(pin_fd);
+        throw;
+    }
+    close(pin_fd);
+}
+
+void fakeRoot(const Config &conf) {
+    idmap_t uidmap, gidmap;
+    idMaps(conf, uidmap, gidmap);
+
+    if (!conf.userns_pin.empty()) {
+        joinPinnedNS(conf.userns_pin, mapsToJson(uidmap, gidmap), uidmap,
+                     gidmap);
+    } else if (ownIdsOnly(uidmap, gidmap)) {
+        // no other process is needed to map ids from outside
+        if (unshare(CLONE_NEWUSER) == -1) {
+            LOG(ERROR) << "failed to create user namespace";
+            throw std::runtime_error(strerror(errno));
+        }
+        writeIdMaps("/proc/self", uidmap, gidmap);
+    } else {
+        auto dummy_worker = createUserNS(uidmap, gidmap, false);
+        try {
+            moveToNS(fs::path("/proc") / std::to_string(dummy_worker) / "ns" /
+                     "user");
+        } catch (const std::exception &e) {
+            killKeeper(dummy_worker);
+            throw;
+        }
+        killKeeper(dummy_worker);
+    }
+
+    if (setuid(0) == -1) {
+        throw std::runtime_error("failed to become fake root");
+    }
+}
+
+}  // namespace yamc
@@ -0,0 +1,27 @@
+#ifndef USERNS_H_
+#define USERNS_H_
+
+#include "config.h"
+
+namespace yamc {
+
+/**
+ * @brief enter a user namespace mapping root to the caller, along with
+ * conf.use_uid and conf.use_gid, and become root in it. jails are created in
+ * this namespace
+ *
+ * ids are mapped by writing uid_map and gid_map directly if only the caller's
+ * own ids are mapped, which denies setgroups in the namespace. extra maps
+ * need new{u,g}idmap, run in parallel
+ *
+ * if conf.userns_pin is set, the pid and identity of a process keeping the
+ * namespace alive are recorded in that file, and later calls with the same id
+ * maps join the namespace instead of creating one. kill the pid recorded to
+ * drop it
+ *
+ */
+void fakeRoot(const Config &conf);
+
+}  // namespace yamc
+
+#endif  // USERNS_H_
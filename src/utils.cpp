@@ -3,11 +3,14 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <fstream>
+
 namespace yamc {
 namespace fs = std::filesystem;
 
@@ -129,6 +132,32 @@ bool writeBufToFile(const fs::path &filename, const void *buf, size_t len) {
     return true;
 }
 
+int openOutputFile(const fs::path &path) {
+    int fd = open(path.c_str(),
+                  O_WRONLY | O_CREAT | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC,
+                  0644);
+    struct stat st;
+    if (fd != -1 && fstat(fd, &st) == 0 && !S_ISREG(st.st_mode)) {
+        close(fd);
+        throw std::runtime_error("failed to open " + path.string() +
+                                 ": not a regular file");
+    }
+    // not to be passed on to programs writing it
+    if (fd == -1 || fcntl(fd, F_SETFL, 0) == -1 || ftruncate(fd, 0) == -1) {
+        auto err = errno;
+        if (fd != -1) close(fd);
+        throw std::runtime_error("failed to open " + path.string() + ": " +
+                                 strerror(err));
+    }
+    return fd;
+}
+
+std::string dumpLine(const nlohmann::json &json) {
+    return json.dump(-1, ' ', false,
+                     nlohmann::json::error_handler_t::replace) +
+           "\n";
+}
+
 ssize_t readFromFd(int fd, void *buf, size_t len) {
     uint8_t *charbuf = (uint8_t *)buf;
 
@@ -144,6 +173,98 @@ ssize_t readFromFd(int fd, void *buf, size_t len) {
     return readSz;
 }
 
+std::string readAllFromFd(int fd) {
+    static const size_t buf_sz = 4096;
+    char buf[buf_sz];
+    std::string content;
+    ssize_t sz;
+    while ((sz = TEMP_FAILURE_RETRY(read(fd, buf, buf_sz))) > 0) {
+        content.append(buf, sz);
+    }
+    if (sz < 0) {
+        throw std::runtime_error(std::string("failed to read: ") +
+                                 strerror(errno));
+    }
+    return content;
+}
+
+static const size_t max_fds_per_msg = 16;
+
+bool sendMsg(int sock, const void *buf, size_t len,
+             const std::vector<int> &fds) {
+    if (fds.size() > max_fds_per_msg) {
+        errno = EINVAL;
+        return false;
+    }
+    iovec iov{.iov_base = const_cast<void *>(buf), .iov_len = len};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_fds_per_msg)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (!fds.empty()) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    }
+    return TEMP_FAILURE_RETRY(sendmsg(sock, &msg, MSG_NOSIGNAL)) ==
+           static_cast<ssize_t>(len);
+}
+
+ssize_t recvMsg(int sock, void *buf, size_t len, std::vector<int> &fds) {
+    iovec iov{.iov_base = buf, .iov_len = len};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_fds_per_msg)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t sz = TEMP_FAILURE_RETRY(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC));
+    if (sz <= 0) {
+        return sz;
+    }
+    auto first = fds.size();
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        auto n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        auto end = fds.size();
+        fds.resize(end + n);
+        memcpy(&fds[end], CMSG_DATA(cmsg), sizeof(int) * n);
+    }
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        for (auto i = first; i < fds.size(); ++i) close(fds[i]);
+        fds.resize(first);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return sz;
+}
+
+void makePipe(int fds[2], size_t size) {
+    static const size_t max_size = [] {
+        size_t sz = 0;
+        std::ifstream("/proc/sys/fs/pipe-max-size") >> sz;
+        return sz;
+    }();
+
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        throw std::runtime_error(std::string("failed to create pipe: ") +
+                                 strerror(errno));
+    }
+    // failing to enlarge only costs more context switches
+    size = std::min(size, max_size);
+    if (size > 0) {
+        fcntl(fds[1], F_SETPIPE_SZ, size);
+    }
+}
+
 void moveToNS(const fs::path &path) {
     int userns = open(path.c_str(), O_RDONLY | O_CLOEXEC);
     if (setns(userns, 0) == -1) {
@@ -153,4 +274,57 @@ void moveToNS(const fs::path &path) {
     close(userns);
 }
 
+fs::path hostPath(const Config &conf, fs::path path) {
+    static const auto isUnder = [](const fs::path &path, const fs::path &dir) {
+        const auto rel = path.lexically_relative(dir);
+        return !rel.empty() && *rel.begin() != "..";
+    };
+
+    path = (conf.chdir_path / path).lexically_normal();
+    for (const auto &link : conf.symlink) {
+        if (isUnder(path, link.src)) {
+            path = (link.dest / path.lexically_relative(link.src))
+                       .lexically_normal();
+            break;
+        }
+    }
+
+    const MountPt *mnt = nullptr;
+    for (const auto *list : {&conf.robind, &conf.rwbind, &conf.tmpfs}) {
+        for (const auto &candidate : *list) {
+            if (isUnder(path, candidate.dest) &&
+                (!mnt || candidate.dest.string().size() >
+                             mnt->dest.string().size())) {
+                mnt = &candidate;
+            }
+        }
+    }
+    if (!mnt || mnt->type == MountPt::MNT_TYPE::TMPFS) {
+        return {};
+    }
+    return (mnt->src / path.lexically_relative(mnt->dest)).lexically_normal();
+}
+
+fs::path findProgram(const Config &conf) {
+    const auto &name = conf.cmdline.at(0);
+    if (name.find('/') != std::string::npos) {
+        return hostPath(conf, name);
+    }
+    // the same search as execvpe in the jail
+    const char *env = getenv("PATH");
+    std::string dirs = env ? env : "/bin:/usr/bin";
+    size_t begin = 0, end;
+    do {
+        end = dirs.find(':', begin);
+        const auto dir = dirs.substr(begin, end - begin);
+        const auto path = hostPath(conf, fs::path(dir.empty() ? "." : dir) /
+                                             name);
+        if (!path.empty() && access(path.c_str(), X_OK) == 0) {
+            return path;
+        }
+        begin = end + 1;
+    } while (end != std::string::npos);
+    return {};
+}
+
 }  // namespace yamc
@@ -1,7 +1,7 @@
 #ifndef UTILS_H_
 #define UTILS_H_
 
-#include "common.h"
+#include "config.h"
 
 namespace yamc {
 
@@ -35,10 +35,68 @@ void moveToNS(const fs::path& path);
 
 ssize_t readFromFd(int fd, void* buf, size_t len);
 
+/**
+ * @brief read fd until EOF. throw on error
+ *
+ */
+std::string readAllFromFd(int fd);
+
 bool writeToFd(int fd, const void* buf, size_t len);
 
 bool writeBufToFile(const fs::path& filename, const void* buf, size_t len);
 
+/**
+ * @brief open path to be written from the start, creating it if missing. it
+ * may be writable by jails, so a symlink there is not followed, and a fifo or
+ * anything else but a regular file is refused before it is truncated. throw on
+ * failure
+ *
+ * @return close-on-exec fd
+ */
+int openOutputFile(const fs::path& path);
+
+/**
+ * @brief json as a single line ending with a newline. invalid utf-8, e.g.
+ * in messages of checkers, is replaced by U+FFFD instead of throwing
+ *
+ */
+std::string dumpLine(const nlohmann::json& json);
+
+/**
+ * @brief send buf along with fds as a single message through a unix socket
+ *
+ */
+bool sendMsg(int sock, const void* buf, size_t len,
+             const std::vector<int>& fds);
+
+/**
+ * @brief receive a single message sent by sendMsg. received fds are appended
+ * to fds and marked close-on-exec
+ *
+ * @return size of the message, 0 if peer closed the socket, -1 on error
+ */
+ssize_t recvMsg(int sock, void* buf, size_t len, std::vector<int>& fds);
+
+/**
+ * @brief create a close-on-exec pipe, with its buffer enlarged to size bytes
+ * or as much as fs.pipe-max-size allows
+ *
+ */
+void makePipe(int fds[2], size_t size);
+
+/**
+ * @brief path on the host of a path seen inside a jail configured by conf,
+ * relative to conf.chdir_path and following its symlinks and mounts. empty if
+ * the path is not backed by the host, e.g. in a tmpfs
+ */
+fs::path hostPath(const Config& conf, fs::path path);
+
+/**
+ * @brief host path of the program conf.cmdline[0] would exec in the jail,
+ * searched like execvpe. empty if not found
+ */
+fs::path findProgram(const Config& conf);
+
 }  // namespace yamc
 
 #endif  // UTILS_H_
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "xxh64.h"
+
+#include <cstring>
+
+namespace yamc {
+
+static const uint64_t prime1 = 0x9e3779b185ebca87ULL;
+static const uint64_t prime2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t prime3 = 0x165667b19e3779f9ULL;
+static const uint64_t prime4 = 0x85ebca77c2b2ae63ULL;
+static const uint64_t prime5 = 0x27d4eb2f165667c5ULL;
+
+static inline uint64_t rotl(uint64_t x, int n) {
+    return (x << n) | (x >> (64 - n));
+}
+
+// input is read as little endian, as the reference implementation does
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = v << 8 | p[i];
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t mixRound(uint64_t acc, uint64_t input) {
+    return rotl(acc + input * prime2, 31) * prime1;
+}
+
+static inline uint64_t merge(uint64_t h, uint64_t acc) {
+    return (h ^ mixRound(0, acc)) * prime1 + prime4;
+}
+
+Xxh64::Xxh64(uint64_t seed)
+    : acc_{seed + prime1 + prime2, seed + prime2, seed, seed - prime1},
+      stripe_len_(0),
+      total_len_(0) {}
+
+Xxh64 &Xxh64::update(const void *data, size_t len) {
+    auto p = static_cast<const uint8_t *>(data);
+    total_len_ += len;
+    if (stripe_len_ + len < sizeof(stripe_)) {
+        memcpy(stripe_ + stripe_len_, p, len);
+        stripe_len_ += len;
+        return *this;
+    }
+    if (stripe_len_ > 0) {
+        size_t fill = sizeof(stripe_) - stripe_len_;
+        memcpy(stripe_ + stripe_len_, p, fill);
+        for (int i = 0; i < 4; ++i) {
+            acc_[i] = mixRound(acc_[i], read64(stripe_ + i * 8));
+        }
+        p += fill;
+        len -= fill;
+        stripe_len_ = 0;
+    }
+    // the accumulators are independent, so that they are updated in parallel
+    uint64_t v0 = acc_[0], v1 = acc_[1], v2 = acc_[2], v3 = acc_[3];
+    for (; len >= sizeof(stripe_);
+         p += sizeof(stripe_), len -= sizeof(stripe_)) {
+        v0 = mixRound(v0, read64(p));
+        v1 = mixRound(v1, read64(p + 8));
+        v2 = mixRound(v2, read64(p + 16));
+        v3 = mixRound(v3, read64(p + 24));
+    }
+    acc_[0] = v0;
+    acc_[1] = v1;
+    acc_[2] = v2;
+    acc_[3] = v3;
+    memcpy(stripe_, p, len);
+    stripe_len_ = len;
+    return *this;
+}
+
+std::string Xxh64::hexdigest() const {
+    uint64_t h;
+    if (total_len_ >= sizeof(stripe_)) {
+        h = rotl(acc_[0], 1) + rotl(acc_[1], 7) + rotl(acc_[2], 12) +
+            rotl(acc_[3], 18);
+        for (auto acc : acc_) h = merge(h, acc);
+    } else {
+        // acc_[2] is the seed until a stripe is consumed
+        h = acc_[2] + prime5;
+    }
+    h += total_len_;
+
+    const uint8_t *p = stripe_, *end = stripe_ + stripe_len_;
+    for (; p + 8 <= end; p += 8) {
+        h = rotl(h ^ mixRound(0, read64(p)), 27) * prime1 + prime4;
+    }
+    if (p + 4 <= end) {
+        h = rotl(h ^ read32(p) * prime1, 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h = rotl(h ^ *p * prime5, 11) * prime1;
+    }
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+
+    static const char hex[] = "0123456789abcdef";
+    std::string digest(16, '0');
+    for (int i = 15; i >= 0; --i, h >>= 4) digest[i] = hex[h & 0xf];
+    return digest;
+}
+
+}  // namespace yamc
@@ -0,0 +1,37 @@
+#ifndef XXH64_H_
+#define XXH64_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace yamc {
+
+/**
+ * xxh64 of the xxhash family, a fast non-cryptographic hash computed
+ * incrementally, for telling outputs apart from expected ones. digests are
+ * the same as `xxhsum -H64`
+ */
+class Xxh64 {
+   private:
+    uint64_t acc_[4];
+    uint8_t stripe_[32];
+    size_t stripe_len_;
+    uint64_t total_len_;
+
+   public:
+    explicit Xxh64(uint64_t seed = 0);
+
+    Xxh64 &update(const void *data, size_t len);
+
+    /**
+     * @brief digest of the data so far in lower case hex. the object can be
+     * updated further
+     *
+     */
+    std::string hexdigest() const;
+};
+
+}  // namespace yamc
+
+#endif  // XXH64_H_
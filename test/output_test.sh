@@ -0,0 +1,120 @@
+#!/bin/sh
+# end-to-end checks of the json lines --batch and --pipeline print, run by
+# `make test`. yamc needs root, so they are skipped otherwise
+#
+# usage: test/output_test.sh build/yamc
+
+yamc=$(realpath "$1")
+if [ "$(id -u)" != 0 ]; then
+    echo "output_test: skipped, not root"
+    exit 0
+fi
+
+dir=$(mktemp -d /tmp/yamc-output-XXXXXX)
+trap 'rm -rf "$dir"' EXIT
+chmod 755 "$dir"
+failures=0
+
+# expect <name> <line number> <fixed string>: the line of the last result
+# contains the string
+expect() {
+    if ! sed -n "$2p" "$dir/result" | grep -qF -- "$3"; then
+        echo "output_test: $1: line $2 lacks $3" >&2
+        sed "s/^/    /" "$dir/result" >&2
+        failures=$((failures + 1))
+    fi
+}
+
+# expect_lines <name> <n>: the last result has n lines, all json objects
+expect_lines() {
+    lines=$(wc -l < "$dir/result")
+    objects=$(grep -c '^{.*}$' "$dir/result")
+    if [ "$lines" != "$2" ] || [ "$objects" != "$2" ]; then
+        echo "output_test: $1: $lines lines, $objects objects, expected $2" >&2
+        sed "s/^/    /" "$dir/result" >&2
+        failures=$((failures + 1))
+    fi
+}
+
+run() {
+    "$yamc" -u 1720 -g 1720 -B "$dir:/w" --chdir=/w "$@" \
+        > "$dir/result" 2> "$dir/log"
+}
+
+# one line per job, including the ones that cannot be parsed
+cat > "$dir/jobs" << EOF
+{"cmdline": ["/bin/echo", "hi"], "stdout": "$dir/echo.out"}
+not json
+{"cmdline": ["/bin/sh", "-c", "exit 3"]}
+EOF
+run --batch - < "$dir/jobs"
+expect_lines batch 3
+expect batch 1 '"returnCode":0'
+expect batch 2 '"error":'
+expect batch 3 '"returnCode":3'
+if [ "$(cat "$dir/echo.out")" != hi ]; then
+    echo "output_test: batch: stdout not redirected" >&2
+    failures=$((failures + 1))
+fi
+
+printf '1 2\n' > "$dir/1.in"
+printf '1 2' > "$dir/1.ans"
+printf '3\n' > "$dir/2.in"
+printf '4' > "$dir/2.ans"
+tests='[{"input": "1.in", "output": "1.out", "answer": "1.ans"},
+        {"input": "2.in", "output": "2.out", "answer": "2.ans"}]'
+
+# a test record per test, in order
+printf '{"run": {"cmdline": ["/bin/cat"]}, "check": {"compare": {}},
+         "tests": %s}' "$tests" > "$dir/compare.json"
+run --pipeline="$dir/compare.json"
+expect_lines compare 2
+expect compare 1 '"accepted":true'
+expect compare 1 '"test":0'
+expect compare 2 '"accepted":false'
+expect compare 2 '"message":"expected 4, found 3"'
+expect compare 2 '"test":1'
+
+printf '{"run": {"cmdline": ["/bin/cat"]}, "check": {"hash": {}},
+         "tests": [{"input": "1.in", "hash": "6bd530e5c185d649"},
+                   {"input": "2.in", "hash": "6bd530e5c185d649"}]}' \
+    > "$dir/hash.json"
+run --pipeline="$dir/hash.json"
+expect_lines hash 2
+expect hash 1 '"xxh64":"6bd530e5c185d649"'
+expect hash 1 '"accepted":true'
+expect hash 2 '"xxh64":"26167c2af5162ca4"'
+expect hash 2 '"accepted":false'
+
+# tests sharing an output are not run while the previous one is checked
+printf '{"run": {"cmdline": ["/bin/cat"]},
+         "check": {"cmdline": ["/bin/sh", "-c",
+                               "sleep 0.2; cmp \\"$1\\" \\"$2\\""]},
+         "tests": [{"input": "1.in", "output": "out", "answer": "1.in"},
+                   {"input": "2.in", "output": "out", "answer": "2.in"}]}' \
+    > "$dir/shared.json"
+run --pipeline="$dir/shared.json"
+expect_lines shared 2
+expect shared 1 '"accepted":true'
+expect shared 2 '"accepted":true'
+
+# what checkers print is not necessarily utf-8, the line is printed anyway
+printf '{"run": {"cmdline": ["/bin/cat"]},
+         "check": {"cmdline": ["/bin/sh", "-c",
+                               "printf \\"bad \\\\377\\"; exit 1"]},
+         "tests": %s}' "$tests" > "$dir/message.json"
+run --pipeline="$dir/message.json"
+expect_lines message 2
+expect message 1 "$(printf '"message":"bad \357\277\275"')"
+expect message 1 '"accepted":false'
+
+# the error of a spec that cannot run is a line too
+echo '{"run": {"cmdline": ["/bin/cat"]}}' > "$dir/bad.json"
+run --pipeline="$dir/bad.json"
+expect_lines error 1
+expect error 1 '"error":"run and tests are required"'
+
+if [ "$failures" != 0 ]; then
+    echo "output_test: $failures failed" >&2
+    exit 1
+fi
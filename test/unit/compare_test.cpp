@@ -0,0 +1,204 @@
+// built-in comparator: every mode on whole buffers, on files, and streamed
+// in chunks of various sizes. run by `make test`
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+
+#include "compare.h"
+
+using namespace yamc;
+
+static int failures = 0;
+
+#define EXPECT(cond)                                                      \
+    do {                                                                  \
+        if (!(cond)) {                                                    \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);    \
+            ++failures;                                                   \
+        }                                                                 \
+    } while (0)
+
+static fs::path dir;
+
+static fs::path writeFile(const std::string &name, const std::string &data) {
+    const auto path = dir / name;
+    std::ofstream(path, std::ios::binary) << data;
+    return path;
+}
+
+/**
+ * @brief compare output with answer in mode as a whole, and streamed in
+ * chunks of 1, 3 and 4096 bytes, which must agree
+ */
+static nlohmann::json compare(const std::string &mode,
+                              const std::string &output,
+                              const std::string &answer) {
+    Comparator comparator(nlohmann::json{{"mode", mode}});
+    auto res = comparator.compare(output.data(), output.size(), answer.data(),
+                                  answer.size());
+    const auto answer_path = writeFile("answer", answer);
+    for (size_t chunk : {1, 3, 4096}) {
+        StreamComparison stream(comparator, answer_path);
+        for (size_t i = 0; i < output.size(); i += chunk) {
+            if (!stream.feed(output.data() + i,
+                             std::min(chunk, output.size() - i))) {
+                break;
+            }
+        }
+        auto streamed = stream.finish();
+        if (streamed.at("verdict") != res.at("verdict")) {
+            fprintf(stderr, "%s of %s streamed by %zu: %s, whole: %s\n",
+                    mode.c_str(), nlohmann::json(output).dump().c_str(), chunk,
+                    streamed.dump().c_str(), res.dump().c_str());
+            ++failures;
+        }
+    }
+    return res;
+}
+
+static bool ok(const nlohmann::json &res) { return res.at("verdict") == "ok"; }
+
+static void testExact() {
+    EXPECT(ok(compare("exact", "1 2\n", "1 2\n")));
+    EXPECT(ok(compare("exact", "", "")));
+    auto res = compare("exact", "1 2", "1 2\n");
+    EXPECT(!ok(res) && res.at("offset") == 3 && res.at("score") == 0);
+    res = compare("exact", "1  2\n", "1 2\n");
+    EXPECT(!ok(res) && res.at("offset") == 2);
+}
+
+static void testTokens() {
+    EXPECT(ok(compare("tokens", "1  2\n\n", "1 2")));
+    EXPECT(ok(compare("tokens", "\t1\r\n2 ", "1\n2\n")));
+    auto res = compare("tokens", "1 3\n", "1 2\n");
+    EXPECT(!ok(res) && res.at("offset") == 2 &&
+           res.at("message") == "expected 2, found 3");
+    res = compare("tokens", "1 2 3", "1 2");
+    EXPECT(!ok(res) && res.at("message") == "expected EOF, found 3");
+    EXPECT(!ok(compare("tokens", "12", "1 2")));
+    // not a number in this mode
+    EXPECT(!ok(compare("tokens", "1.0", "1")));
+}
+
+static void testLines() {
+    EXPECT(ok(compare("lines", "a  \nb\n\n\n", "a\nb")));
+    EXPECT(ok(compare("lines", "a\nb", "a \nb\n\n")));
+    EXPECT(!ok(compare("lines", "a b\n", "a  b\n")));
+    EXPECT(!ok(compare("lines", "a\n\nb\n", "a\nb\n")));
+    EXPECT(!ok(compare("lines", " a\n", "a\n")));
+    auto res = compare("lines", "abc\nabd\n", "abc\nabc\n");
+    EXPECT(!ok(res) && res.at("offset") == 6);
+    EXPECT(!ok(compare("lines", "a\nb  c", "a\nb")));
+    EXPECT(!ok(compare("lines", "a\nb\nc\n", "a\nb\n")));
+}
+
+static void testFloat() {
+    EXPECT(ok(compare("float", "1.0000001 2\n", "1 2")));
+    EXPECT(ok(compare("float", "1000000.5", "1000000")));
+    EXPECT(!ok(compare("float", "1.1", "1")));
+    // nan is compared as a token
+    EXPECT(ok(compare("float", "nan", "nan")));
+    EXPECT(!ok(compare("float", "nan", "1")));
+    EXPECT(ok(compare("float", "abc", "abc")));
+    EXPECT(!ok(compare("float", "abd", "abc")));
+
+    Comparator loose(nlohmann::json{{"mode", "float"}, {"eps", 0.5}});
+    EXPECT(ok(loose.compare("1.4", 3, "1", 1)));
+}
+
+static void testInvalid() {
+    bool thrown = false;
+    try {
+        Comparator(nlohmann::json{{"mode", "bytes"}});
+    } catch (const std::exception &e) {
+        thrown = true;
+    }
+    EXPECT(thrown);
+    thrown = false;
+    try {
+        Comparator(nlohmann::json{{"eps", -1}});
+    } catch (const std::exception &e) {
+        thrown = true;
+    }
+    EXPECT(thrown);
+}
+
+/**
+ * @brief a long line differing early is reported before it ends, and one
+ * that matches is not kept whole
+ */
+static void testLongLine() {
+    Comparator comparator(nlohmann::json{{"mode", "lines"}});
+    const std::string line(1 << 22, 'a');
+    const auto answer = writeFile("long", line + "\n");
+
+    StreamComparison same(comparator, answer);
+    bool fed = true;
+    for (size_t i = 0; i < line.size(); i += 65536) {
+        fed = fed && same.feed(line.data() + i, 65536);
+    }
+    EXPECT(fed && same.feed("  \n", 3));
+    EXPECT(ok(same.finish()));
+
+    std::string chunk = line.substr(0, 65536);
+    chunk[100] = 'b';
+    StreamComparison differs(comparator, answer);
+    EXPECT(!differs.feed(chunk.data(), chunk.size()));
+    auto res = differs.finish();
+    EXPECT(!ok(res) && res.at("offset") == 100);
+}
+
+static void testFiles() {
+    Comparator comparator(nlohmann::json{{"mode", "tokens"}});
+    const auto output = writeFile("out", "1 2\n");
+    const auto answer = writeFile("ans", "1 2");
+    EXPECT(ok(comparator.compare(output, answer)));
+    EXPECT(!ok(comparator.compare(writeFile("empty", ""), answer)));
+
+    int out_fd = open(output.c_str(), O_RDONLY | O_CLOEXEC);
+    int ans_fd = open(answer.c_str(), O_RDONLY | O_CLOEXEC);
+    EXPECT(ok(comparator.compare(out_fd, ans_fd)));
+    close(out_fd);
+    close(ans_fd);
+
+    // neither followed nor waited for
+    const auto link = dir / "link";
+    const auto fifo = dir / "fifo";
+    fs::create_symlink(output, link);
+    mkfifo(fifo.c_str(), 0600);
+    for (const auto &path : {link, fifo, dir / "missing"}) {
+        bool thrown = false;
+        try {
+            comparator.compare(path, answer);
+        } catch (const std::exception &e) {
+            thrown = true;
+        }
+        EXPECT(thrown);
+    }
+}
+
+int main() {
+    char tmpl[] = "/tmp/yamc-compare-XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    dir = tmpl;
+    testExact();
+    testTokens();
+    testLines();
+    testFloat();
+    testInvalid();
+    testLongLine();
+    testFiles();
+    fs::remove_all(dir);
+    if (failures != 0) {
+        fprintf(stderr, "compare_test: %d failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+// xxh64 against digests of the reference implementation, whole and fed in
+// pieces across stripe boundaries. run by `make test`
+
+#include <cstdio>
+#include <string>
+
+#include "xxh64.h"
+
+using namespace yamc;
+
+static int failures = 0;
+
+static void expect(const std::string &data, uint64_t seed,
+                   const std::string &digest) {
+    auto whole = Xxh64(seed).update(data.data(), data.size()).hexdigest();
+    if (whole != digest) {
+        fprintf(stderr, "%zu bytes, seed %lu: %s, expected %s\n", data.size(),
+                (unsigned long)seed, whole.c_str(), digest.c_str());
+        ++failures;
+    }
+    for (size_t piece : {1, 7, 31, 33}) {
+        Xxh64 hash(seed);
+        for (size_t i = 0; i < data.size(); i += piece) {
+            hash.update(data.data() + i, std::min(piece, data.size() - i));
+        }
+        if (hash.hexdigest() != digest) {
+            fprintf(stderr, "%zu bytes fed by %zu: %s, expected %s\n",
+                    data.size(), piece, hash.hexdigest().c_str(),
+                    digest.c_str());
+            ++failures;
+        }
+    }
+}
+
+int main() {
+    std::string bytes;
+    for (int i = 0; i < 1280; ++i) {
+        bytes += static_cast<char>(i % 256);
+    }
+    const std::string sentence = "Nobody inspects the spammish repetition";
+
+    expect("", 0, "ef46db3751d8e999");
+    expect("a", 0, "d24ec4f1a98c6e5b");
+    expect("abc", 0, "44bc2cf5ad770999");
+    expect(sentence, 0, "fbcea83c8a378bf1");
+    expect(bytes, 0, "afc184ad7938a354");
+    expect("", 2654435761, "ac75fda2929b17ef");
+    expect("a", 2654435761, "393da8b78992279b");
+    expect("abc", 2654435761, "1318df30094a85fd");
+    expect(sentence, 2654435761, "56db22dd5b051147");
+    expect(bytes, 2654435761, "a124e937a81c3d87");
+
+    // digests can be taken midway
+    Xxh64 hash;
+    hash.update("a", 1);
+    const auto first = hash.hexdigest();
+    hash.update("bc", 2);
+    if (first != "d24ec4f1a98c6e5b" || hash.hexdigest() != "44bc2cf5ad770999") {
+        fprintf(stderr, "digest midway changed the state\n");
+        ++failures;
+    }
+
+    if (failures != 0) {
+        fprintf(stderr, "xxh64_test: %d failed\n", failures);
+        return 1;
+    }
+    return 0;
+}